@@ -0,0 +1,16 @@
+#pragma once
+
+namespace advent
+{
+// Whether the CPU supports AVX2, checked once; always false where it cannot be
+// checked, so callers fall back to their scalar code
+inline bool has_avx2()
+{
+#if defined(__GNUC__) && defined(__x86_64__)
+    static const bool result = __builtin_cpu_supports("avx2");
+    return result;
+#else
+    return false;
+#endif
+}
+}
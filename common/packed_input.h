@@ -0,0 +1,205 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Reading of line-per-command puzzle input into fixed-size packed commands,
+// shared by the days that parse a block at a time and can cache the result.
+// Each day supplies its own command type, parser, and cache magic.
+namespace advent
+{
+inline bool is_space(char c)
+{
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+// Parses the lines in [begin, end) with parse(line_begin, line_end), which is
+// given each line with no surrounding whitespace, and passes each command to
+// out. Unless last is set, a final line with no newline may be incomplete, so
+// is left; the return value is where the unparsed text starts.
+template <class Parse, class Out>
+const char* parse_lines(const char* begin, const char* end, bool last, const Parse& parse, const Out& out)
+{
+    for (const char* curr = begin;;)
+    {
+        while (curr != end && is_space(*curr))
+        {
+            ++curr;
+        }
+
+        const char* line_end = std::find(curr, end, '\n');
+        if (curr == end || (line_end == end && !last))
+        {
+            return curr;
+        }
+
+        const char* command_end = line_end;
+        while (is_space(command_end[-1]))
+        {
+            --command_end;
+        }
+        out(parse(curr, command_end));
+
+        curr = line_end == end ? end : line_end + 1;
+    }
+}
+
+// Commands saved already packed, so they need no parsing:
+//
+// * CacheHeader
+// * count packed commands
+//
+// Integers are in host byte order.
+struct CacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t count;
+};
+
+static_assert(sizeof(CacheHeader) == 24, "CacheHeader is written as is");
+
+constexpr uint32_t CACHE_VERSION = 1;
+
+inline CacheHeader cache_header(const char (&magic)[8], uint64_t count)
+{
+    CacheHeader header {};
+    std::copy(std::begin(magic), std::end(magic), header.magic);
+    header.version = CACHE_VERSION;
+    header.count   = count;
+    return header;
+}
+
+template <class Packed>
+void write_cache(std::ostream& out, const char (&magic)[8], const std::vector<Packed>& commands)
+{
+    const auto header = cache_header(magic, commands.size());
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(commands.data()), commands.size() * sizeof(Packed));
+}
+
+// Reads packed commands from either the puzzle's text, parsed a block at a
+// time, or a cache written by write_cache with the same magic, which is
+// recognised by its header. Each command is passed to out as it is read, so
+// only the current block is held.
+template <class Packed, class Parse, class Out>
+void for_each_packed(std::istream& in, const char (&magic)[8], const Parse& parse, const Out& out, size_t block_size)
+{
+    std::vector<char> block(std::max(block_size, sizeof(CacheHeader)));
+
+    in.read(block.data(), static_cast<std::streamsize>(block.size()));
+    size_t filled = static_cast<size_t>(in.gcount());
+
+    CacheHeader header;
+    if (filled >= sizeof(header) && std::equal(std::begin(magic), std::end(magic), block.data()))
+    {
+        std::memcpy(&header, block.data(), sizeof(header));
+        if (header.version != CACHE_VERSION)
+        {
+            throw std::runtime_error("unknown command cache version");
+        }
+
+        // The count is only trusted as far as there are commands to read
+        const char* curr = block.data() + sizeof(header);
+        for (uint64_t remaining = header.count; remaining > 0; --remaining)
+        {
+            const size_t available = filled - static_cast<size_t>(curr - block.data());
+            if (available < sizeof(Packed))
+            {
+                std::memmove(block.data(), curr, available);
+                in.read(block.data() + available, static_cast<std::streamsize>(block.size() - available));
+                filled = available + static_cast<size_t>(in.gcount());
+                curr   = block.data();
+                if (filled < sizeof(Packed))
+                {
+                    throw std::runtime_error("command cache is truncated");
+                }
+            }
+
+            Packed command;
+            std::memcpy(&command, curr, sizeof(command));
+            curr += sizeof(command);
+            out(command);
+        }
+        return;
+    }
+
+    for (;;)
+    {
+        const bool last  = !in;
+        const char* rest = parse_lines(block.data(), block.data() + filled, last, parse, out);
+        if (last)
+        {
+            return;
+        }
+
+        // Carry the incomplete line over, making room if it fills the block
+        const size_t carried = filled - static_cast<size_t>(rest - block.data());
+        std::memmove(block.data(), rest, carried);
+        if (carried == block.size())
+        {
+            block.resize(block.size() * 2);
+        }
+
+        in.read(block.data() + carried, static_cast<std::streamsize>(block.size() - carried));
+        filled = carried + static_cast<size_t>(in.gcount());
+    }
+}
+
+// As for_each_packed, collecting the commands
+template <class Packed, class Parse>
+std::vector<Packed> read_packed(std::istream& in, const char (&magic)[8], const Parse& parse, size_t block_size)
+{
+    std::vector<Packed> result;
+    for_each_packed<Packed>(in, magic, parse, [&](Packed c) { result.push_back(c); }, block_size);
+    return result;
+}
+
+// As for_each_packed, but also saves the commands to the file named by
+// ADVENT_CACHE (the -c option of the day executables) if it is set; pass that
+// file back in as the input to skip parsing next time. The header goes in
+// last, so a file left by a failed read is not taken for a cache.
+template <class Packed, class Parse, class Out>
+void for_each_cached(std::istream& in, const char (&magic)[8], const Parse& parse, const Out& out)
+{
+    const char* path = std::getenv("ADVENT_CACHE");
+    if (!path)
+    {
+        for_each_packed<Packed>(in, magic, parse, out, 1 << 16);
+        return;
+    }
+
+    std::ofstream cache(path, std::ios::binary);
+    CacheHeader header {};
+    cache.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    uint64_t count = 0;
+    for_each_packed<Packed>(
+        in, magic, parse,
+        [&](Packed c)
+        {
+            cache.write(reinterpret_cast<const char*>(&c), sizeof(c));
+            ++count;
+            out(c);
+        },
+        1 << 16);
+
+    header = cache_header(magic, count);
+    cache.seekp(0);
+    cache.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (!cache)
+    {
+        throw std::runtime_error(std::string("could not write ") + path);
+    }
+}
+}
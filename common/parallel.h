@@ -0,0 +1,60 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+namespace advent
+{
+// Split [0, count) into ranges of chunk_size, and run f(begin, end) on each on
+// up to threads threads, the calling one included. Threads take the next range
+// as they finish one, so uneven ranges balance out; by default the ranges are
+// as large as possible, one per thread.
+template <class F> void parallel_ranges(size_t count, size_t threads, const F& f, size_t chunk_size = 0)
+{
+    threads = std::max<size_t>(1, std::min(threads, count));
+    if (chunk_size == 0)
+    {
+        chunk_size = std::max<size_t>(1, (count + threads - 1) / threads);
+    }
+    threads = std::min(threads, (count + chunk_size - 1) / chunk_size);
+
+    std::atomic<size_t> next_chunk(0);
+    const auto work = [&]
+    {
+        for (size_t begin = next_chunk.fetch_add(chunk_size); begin < count; begin = next_chunk.fetch_add(chunk_size))
+        {
+            f(begin, std::min(begin + chunk_size, count));
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < threads; ++i)
+    {
+        workers.emplace_back(work);
+    }
+    work();
+
+    for (auto& t : workers)
+    {
+        t.join();
+    }
+}
+
+// Threads to use; set by ADVENT_THREADS (the -j option of the day
+// executables), otherwise one per core
+inline size_t thread_count()
+{
+    if (const char* threads = std::getenv("ADVENT_THREADS"))
+    {
+        const auto count = std::strtoul(threads, nullptr, 10);
+        if (count > 0)
+        {
+            return count;
+        }
+    }
+    return std::max(1U, std::thread::hardware_concurrency());
+}
+}
@@ -1,8 +1,19 @@
 #include <iostream>
+#include <algorithm>
+#include <cassert>
+#include <chrono>
 #include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <random>
+#include <stdexcept>
+#include <vector>
 
 #include <gtest/gtest.h>
 
+#include "packed_input.h"
+
 namespace day_10_impl
 {
 enum class Op
@@ -17,7 +28,9 @@ struct Command
     int arg;
 };
 
-std::vector<Command> read_input(std::istream& in)
+// Reads the program with formatted input; kept to check and time the packed
+// parser against
+std::vector<Command> read_input_formatted(std::istream& in)
 {
     std::vector<Command> result;
 
@@ -39,6 +52,135 @@ std::vector<Command> read_input(std::istream& in)
     return result;
 }
 
+bool operator==(const Command& a, const Command& b)
+{
+    return a.op == b.op && a.arg == b.arg;
+}
+
+// A command in 32 bits: the top bit is set for addx, and the rest holds its
+// argument in two's complement
+using PackedCommand = uint32_t;
+
+constexpr uint32_t ADD_X_BIT = uint32_t(1) << 31;
+constexpr int32_t MAX_ARG    = (int32_t(1) << 30) - 1;
+
+PackedCommand pack(const Command& c)
+{
+    assert(c.arg >= -MAX_ARG - 1 && c.arg <= MAX_ARG);
+    return c.op == Op::ADD_X ? ADD_X_BIT | (static_cast<uint32_t>(c.arg) & ~ADD_X_BIT) : 0;
+}
+
+Command unpack(PackedCommand c)
+{
+    if (!(c & ADD_X_BIT))
+    {
+        return {Op::NOOP, 0};
+    }
+
+    // Sign extend from 31 bits: shift the flag out, then arithmetic shift back
+    return {Op::ADD_X, static_cast<int32_t>(c << 1) >> 1};
+}
+
+std::vector<Command> unpack(const std::vector<PackedCommand>& packed)
+{
+    std::vector<Command> result;
+    result.reserve(packed.size());
+    std::transform(packed.begin(), packed.end(), std::back_inserter(result), [](PackedCommand c) { return unpack(c); });
+    return result;
+}
+
+// One command, e.g. "addx -3", from [begin, end) with no surrounding whitespace
+PackedCommand parse_command(const char* begin, const char* end)
+{
+    const auto fail = [&] { throw std::runtime_error("bad command: " + std::string(begin, end)); };
+
+    const auto starts_with = [&](const char* name) { return end - begin >= 4 && std::equal(begin, begin + 4, name); };
+    if (starts_with("noop") && end - begin == 4)
+    {
+        return 0;
+    }
+    if (!starts_with("addx"))
+    {
+        fail();
+    }
+
+    const char* curr = begin + 4;
+    while (curr != end && advent::is_space(*curr))
+    {
+        ++curr;
+    }
+    if (curr == begin + 4)
+    {
+        fail();
+    }
+
+    bool negative = false;
+    if (curr != end && (*curr == '-' || *curr == '+'))
+    {
+        negative = *curr == '-';
+        ++curr;
+    }
+
+    int64_t arg        = 0;
+    const char* digits = curr;
+    for (; curr != end && *curr >= '0' && *curr <= '9' && arg <= MAX_ARG + 1; ++curr)
+    {
+        arg = arg * 10 + (*curr - '0');
+    }
+    if (negative)
+    {
+        arg = -arg;
+    }
+
+    if (curr == digits || curr != end || arg < -MAX_ARG - 1 || arg > MAX_ARG)
+    {
+        fail();
+    }
+
+    return ADD_X_BIT | (static_cast<uint32_t>(arg) & ~ADD_X_BIT);
+}
+
+// Marks a cache of packed commands as this day's; see advent::CacheHeader
+constexpr char CACHE_MAGIC[8] = {'A', 'O', 'C', '1', '0', 'C', 'P', 'U'};
+
+void write_cache(std::ostream& out, const std::vector<PackedCommand>& commands)
+{
+    advent::write_cache(out, CACHE_MAGIC, commands);
+}
+
+// Reads packed commands from either the puzzle's text, parsed a block at a
+// time, or a cache written by write_cache
+std::vector<PackedCommand> read_packed(std::istream& in, size_t block_size = 1 << 16)
+{
+    return advent::read_packed<PackedCommand>(in, CACHE_MAGIC, parse_command, block_size);
+}
+
+// A random program of count commands, about a third of them noops
+std::vector<Command> random_commands(size_t count, unsigned seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<int> arg(-40, 40);
+
+    std::vector<Command> result;
+    result.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const int a = arg(gen);
+        result.push_back(a % 3 == 0 ? Command {Op::NOOP, 0} : Command {Op::ADD_X, a});
+    }
+    return result;
+}
+
+std::string to_text(const std::vector<Command>& commands)
+{
+    std::string result;
+    for (const auto& c : commands)
+    {
+        result += c.op == Op::NOOP ? "noop\n" : "addx " + std::to_string(c.arg) + "\n";
+    }
+    return result;
+}
+
 std::vector<int> simulate(const std::vector<Command>& commands)
 {
     // Cycles are 1-indexed; so push a 1.
@@ -84,31 +226,269 @@ std::vector<std::string> draw(const std::vector<int>& cycles)
     return result;
 }
 
+// The value of X over a run of the program, kept only at the cycles where it
+// changes, so its size follows the number of addx commands rather than cycles
+class RegisterTrace
+{
+  public:
+    // X holds value from the start of cycle first onwards
+    struct Change
+    {
+        uint32_t first;
+        int32_t value;
+    };
+
+    RegisterTrace() = default;
+
+    explicit RegisterTrace(const std::vector<Command>& commands)
+    {
+        m_changes.reserve(std::count_if(commands.begin(), commands.end(), [](const Command& c) { return c.op == Op::ADD_X; }));
+        for (const auto& c : commands)
+        {
+            run(c);
+        }
+    }
+
+    // Runs the next command of the program
+    void run(const Command& c)
+    {
+        switch (c.op)
+        {
+        case Op::NOOP:
+            m_end += 1;
+            break;
+        case Op::ADD_X:
+            m_end += 2;
+            if (c.arg != 0)
+            {
+                m_changes.push_back({static_cast<uint32_t>(m_end), (m_changes.empty() ? 1 : m_changes.back().value) + c.arg});
+            }
+            break;
+        }
+        // Cycles are kept in 32 bits
+        assert(m_end <= UINT32_MAX);
+    }
+
+    // The first cycle after the program has finished
+    size_t end() const { return m_end; }
+    const std::vector<Change>& changes() const { return m_changes; }
+
+    // X during the given cycle, in O(log changes)
+    int at(size_t cycle) const
+    {
+        const auto after = std::upper_bound(m_changes.begin(), m_changes.end(), cycle,
+                                            [](size_t c, const Change& change) { return c < change.first; });
+        return after == m_changes.begin() ? 1 : std::prev(after)->value;
+    }
+
+    // Looks up X at cycles that never go backwards, in amortized O(1)
+    class Cursor
+    {
+      public:
+        explicit Cursor(const RegisterTrace& trace) : m_trace(&trace) {}
+
+        int at(size_t cycle)
+        {
+            const auto& changes = m_trace->m_changes;
+            while (m_next < changes.size() && changes[m_next].first <= cycle)
+            {
+                m_value = changes[m_next++].value;
+            }
+            return m_value;
+        }
+
+      private:
+        const RegisterTrace* m_trace;
+        size_t m_next = 0;
+        int m_value   = 1;
+    };
+
+    Cursor cursor() const { return Cursor(*this); }
+
+  private:
+    std::vector<Change> m_changes;
+    size_t m_end = 1;
+};
+
+// Runs the program straight from the input, a command at a time, so only
+// the trace is kept; saves it packed to the file named by ADVENT_CACHE if it
+// is set
+RegisterTrace read_trace(std::istream& in)
+{
+    RegisterTrace result;
+    advent::for_each_cached<PackedCommand>(in, CACHE_MAGIC, parse_command, [&](PackedCommand c) { result.run(unpack(c)); });
+    return result;
 }
 
-void day_10(std::istream& in, std::ostream& out)
+std::vector<std::string> draw(const RegisterTrace& trace)
 {
-    using namespace day_10_impl;
+    std::vector<std::string> result(6, std::string(40, '.'));
 
-    const auto commands = read_input(in);
-    const auto cycles   = simulate(commands);
+    auto x       = trace.cursor();
+    size_t cycle = 1;
+    for (std::string& row : result)
+    {
+        for (size_t col = 0; col < row.size(); ++col, ++cycle)
+        {
+            if (std::abs(x.at(cycle) - int(col)) <= 1)
+            {
+                row[col] = '#';
+            }
+        }
+    }
 
+    return result;
+}
+
+// The signal strength summed over cycles 20, 60, 100, 140, 180 and 220
+int64_t signal_strength(const RegisterTrace& trace)
+{
+    auto x         = trace.cursor();
     int64_t result = 0;
     for (const auto i : {20, 60, 100, 140, 180, 220})
     {
-        result += cycles[i] * i;
+        result += int64_t(x.at(i)) * i;
+    }
+    return result;
+}
+
+TEST(Day10, RegisterTrace)
+{
+    auto commands = random_commands(2000, 3);
+    commands.push_back({Op::ADD_X, 0});
+
+    const auto cycles = simulate(commands);
+    const RegisterTrace trace(commands);
+
+    EXPECT_EQ(trace.end(), cycles.size() - 1);
+    EXPECT_LT(trace.changes().size(), commands.size());
+
+    // Also built as the program is read, from text or a cache
+    const auto text = to_text(commands);
+    std::stringstream text_in(text), packed_in(text), cache_in;
+    write_cache(cache_in, read_packed(packed_in));
+    const auto text_trace  = read_trace(text_in);
+    const auto cache_trace = read_trace(cache_in);
+    EXPECT_EQ(text_trace.end(), trace.end());
+    EXPECT_EQ(cache_trace.end(), trace.end());
+
+    auto cursor = trace.cursor();
+    for (size_t cycle = 1; cycle < cycles.size(); ++cycle)
+    {
+        EXPECT_EQ(trace.at(cycle), cycles[cycle]) << cycle;
+        EXPECT_EQ(cursor.at(cycle), cycles[cycle]) << cycle;
+        EXPECT_EQ(text_trace.at(cycle), cycles[cycle]) << cycle;
+        EXPECT_EQ(cache_trace.at(cycle), cycles[cycle]) << cycle;
+    }
+
+    EXPECT_EQ(draw(trace), draw(cycles));
+}
+
+TEST(Day10, PackedParser)
+{
+    auto commands = random_commands(1000, 10);
+    commands.push_back({Op::ADD_X, MAX_ARG});
+    commands.push_back({Op::ADD_X, -MAX_ARG - 1});
+
+    std::string text = to_text(commands);
+    text.insert(0, "\n  ");
+    text.replace(text.find('\n', 10), 1, "\r\n");
+    text.pop_back();
+
+    std::stringstream formatted_in(text);
+    ASSERT_EQ(read_input_formatted(formatted_in), commands);
+
+    for (const size_t block_size : {1, 5, 4096})
+    {
+        std::stringstream ss_in(text);
+        const auto packed = read_packed(ss_in, block_size);
+        EXPECT_EQ(unpack(packed), commands) << block_size;
+
+        std::stringstream cache;
+        write_cache(cache, packed);
+        EXPECT_EQ(read_packed(cache, block_size), packed) << block_size;
+    }
+
+    for (const char* bad : {"nop\n", "noop 1\n", "addx\n", "addx -\n", "addx 1x\n", "addx5\n", "addx 9999999999\n"})
+    {
+        std::stringstream ss_in(bad);
+        EXPECT_THROW(read_packed(ss_in), std::runtime_error) << bad;
     }
+}
+
+// Not run by default; use --gtest_also_run_disabled_tests
+TEST(Day10, DISABLED_BenchmarkParser)
+{
+    const auto text = to_text(random_commands(10000000, 42));
+
+    std::stringstream formatted_in(text);
+    auto start           = std::chrono::steady_clock::now();
+    const auto formatted = read_input_formatted(formatted_in);
+
+    const std::chrono::duration<double> formatted_time = std::chrono::steady_clock::now() - start;
+
+    std::stringstream packed_in(text);
+    start             = std::chrono::steady_clock::now();
+    const auto packed = read_packed(packed_in);
+
+    const std::chrono::duration<double> packed_time = std::chrono::steady_clock::now() - start;
+
+    std::stringstream cache;
+    write_cache(cache, packed);
+    start             = std::chrono::steady_clock::now();
+    const auto cached = read_packed(cache);
+
+    const std::chrono::duration<double> cache_time = std::chrono::steady_clock::now() - start;
+
+    EXPECT_EQ(unpack(packed), formatted);
+    EXPECT_EQ(cached, packed);
+    std::cout << formatted.size() << " commands: formatted " << formatted_time.count() << "s, packed " << packed_time.count()
+              << "s, from cache " << cache_time.count() << "s" << std::endl;
+}
+
+// Not run by default; use --gtest_also_run_disabled_tests
+TEST(Day10, DISABLED_BenchmarkRegisterTrace)
+{
+    const auto commands = random_commands(10000000, 42);
+
+    auto start        = std::chrono::steady_clock::now();
+    const auto cycles = simulate(commands);
+    int64_t sampled   = 0;
+    for (size_t cycle = 1; cycle < cycles.size(); cycle += 1000)
+    {
+        sampled += cycles[cycle];
+    }
+
+    const std::chrono::duration<double> vector_time = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    const RegisterTrace trace(commands);
+    auto x = trace.cursor();
+    for (size_t cycle = 1; cycle < trace.end(); cycle += 1000)
+    {
+        sampled -= x.at(cycle);
+    }
+
+    const std::chrono::duration<double> trace_time = std::chrono::steady_clock::now() - start;
+
+    EXPECT_EQ(sampled, 0);
+    std::cout << cycles.size() << " cycles: vector " << vector_time.count() << "s, " << cycles.size() * sizeof(int) << " bytes; trace "
+              << trace_time.count() << "s, " << trace.changes().size() * sizeof(RegisterTrace::Change) << " bytes" << std::endl;
+}
+}
+
+void day_10(std::istream& in, std::ostream& out)
+{
+    using namespace day_10_impl;
 
-    out << result;
+    out << signal_strength(read_trace(in));
 }
 
 void day_10_adv(std::istream& in, std::ostream& out)
 {
     using namespace day_10_impl;
 
-    const auto commands = read_input(in);
-    const auto cycles   = simulate(commands);
-    const auto display  = draw(cycles);
+    const auto display = draw(read_trace(in));
 
     for (const auto& line : display)
     {
@@ -1,9 +1,27 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <cassert>
+#include <chrono>
 #include <iostream>
+#include <random>
+#include <sstream>
 
 #include <gtest/gtest.h>
 
+#include "cpu.h"
+#include "parallel.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define DAY_6_AVX2 1
+#include <immintrin.h>
+#endif
+
 namespace day_6_impl
 {
+constexpr size_t NOT_FOUND = static_cast<size_t>(-1);
+
 template <class IteratorT> bool unique(IteratorT begin, IteratorT end)
 {
     std::array<size_t, 256> counts = {{0}};
@@ -21,7 +39,7 @@ template <class IteratorT> bool unique(IteratorT begin, IteratorT end)
 template <class IteratorT> size_t find_token(IteratorT begin, IteratorT end, size_t token_size)
 {
     auto curr = begin;
-    while (curr + token_size < end)
+    while (curr + token_size <= end)
     {
         if (day_6_impl::unique(curr, curr + token_size))
         {
@@ -29,7 +47,461 @@ template <class IteratorT> size_t find_token(IteratorT begin, IteratorT end, siz
         }
         ++curr;
     }
-    return static_cast<size_t>(-1);
+    return NOT_FOUND;
+}
+
+// Same result as find_token, but in a single pass. Instead of re-counting every
+// window, remember where each byte was last seen; when a byte repeats inside the
+// window, the window start skips ahead to just past its previous occurrence.
+template <class IteratorT> size_t find_token_sliding(IteratorT begin, IteratorT end, size_t token_size)
+{
+    if (token_size == 0)
+    {
+        return 0;
+    }
+
+    // Position + 1 of the last occurrence of each byte; 0 is never seen
+    std::array<size_t, 256> last_seen = {{0}};
+
+    size_t window_start = 0;
+    size_t pos          = 0;
+    for (auto curr = begin; curr != end; ++curr, ++pos)
+    {
+        auto& last   = last_seen[static_cast<unsigned char>(*curr)];
+        window_start = std::max(window_start, last);
+        last         = pos + 1;
+
+        if (pos + 1 - window_start == token_size)
+        {
+            return pos + 1;
+        }
+    }
+    return NOT_FOUND;
+}
+
+// Each symbol gets its own bit in masks; the XOR of the masks in a window only
+// has token_size bits set if no symbol repeats (a repeated symbol cancels itself
+// out, or at least does not add a new bit)
+template <class MaskT>
+size_t find_token_bitmask(const char* begin, const char* end, size_t token_size, const std::array<MaskT, 256>& masks)
+{
+    const auto data = reinterpret_cast<const unsigned char*>(begin);
+    const auto size = static_cast<size_t>(end - begin);
+
+    MaskT window = 0;
+    for (size_t pos = 0; pos < size; ++pos)
+    {
+        window ^= masks[data[pos]];
+        if (pos >= token_size)
+        {
+            window ^= masks[data[pos - token_size]];
+        }
+
+        if (pos + 1 >= token_size && std::bitset<sizeof(MaskT) * 8>(window).count() == token_size)
+        {
+            return pos + 1;
+        }
+    }
+    return NOT_FOUND;
+}
+
+#ifdef DAY_6_AVX2
+__attribute__((target("avx2"))) inline __m256i load(const uint32_t* p)
+{
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+}
+
+__attribute__((target("avx2"))) inline void store(uint32_t* p, __m256i v)
+{
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v);
+}
+
+// Smallest and largest byte in [begin, end), which must not be empty
+__attribute__((target("avx2"))) std::pair<unsigned char, unsigned char> byte_range_avx2(const char* begin, const char* end)
+{
+    const auto data = reinterpret_cast<const unsigned char*>(begin);
+    const auto size = static_cast<size_t>(end - begin);
+
+    __m256i low  = _mm256_set1_epi8(static_cast<char>(data[0]));
+    __m256i high = low;
+
+    size_t pos = 0;
+    for (; pos + 32 <= size; pos += 32)
+    {
+        const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos));
+        low                 = _mm256_min_epu8(low, bytes);
+        high                = _mm256_max_epu8(high, bytes);
+    }
+
+    alignas(32) unsigned char lows[32];
+    alignas(32) unsigned char highs[32];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lows), low);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(highs), high);
+
+    unsigned char result_low  = *std::min_element(lows, lows + 32);
+    unsigned char result_high = *std::max_element(highs, highs + 32);
+    for (; pos < size; ++pos)
+    {
+        result_low  = std::min(result_low, data[pos]);
+        result_high = std::max(result_high, data[pos]);
+    }
+    return {result_low, result_high};
+}
+
+// Bitmask search for alphabets spanning at most 32 byte values starting at
+// base, vectorized over blocks of candidate windows. The masks of windows of
+// length 1, 2, 4, ... are built up by doubling, and the window of token_size is
+// the XOR of the power-of-two windows making up token_size, so each position
+// costs O(log token_size) vector operations.
+__attribute__((target("avx2"))) size_t find_token_bitmask_avx2(const char* begin, const char* end, size_t token_size,
+                                                               unsigned char base)
+{
+    constexpr size_t BLOCK = 256;
+    constexpr size_t SPAN  = BLOCK + 32;
+
+    const auto data = reinterpret_cast<const unsigned char*>(begin);
+    const auto size = static_cast<size_t>(end - begin);
+
+    const __m256i ones      = _mm256_set1_epi32(1);
+    const __m256i bases     = _mm256_set1_epi32(base);
+    const __m256i expected  = _mm256_set1_epi32(static_cast<int>(token_size));
+    const __m256i low_bits  = _mm256_set1_epi8(0x0f);
+    const __m256i byte_ones = _mm256_set1_epi8(1);
+    const __m256i pop_table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3,
+                                               2, 3, 3, 4);
+
+    // runs[i] holds the mask of the window of the current power of two length
+    // starting at i; windows[i] accumulates the mask of the token_size window.
+    // Doubling reads up to 32 entries past the SPAN loaded from the data, so
+    // those stay zero; the runs that include them are never used, but every
+    // run that is used is doubled from runs that are all whole.
+    alignas(32) uint32_t runs[SPAN + 32] = {};
+    alignas(32) uint32_t windows[BLOCK];
+
+    size_t pos = 0;
+    for (; pos + SPAN <= size; pos += BLOCK)
+    {
+        for (size_t i = 0; i < SPAN; i += 8)
+        {
+            const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(data + pos + i));
+            store(runs + i, _mm256_sllv_epi32(ones, _mm256_sub_epi32(_mm256_cvtepu8_epi32(bytes), bases)));
+        }
+        for (size_t i = 0; i < BLOCK; i += 8)
+        {
+            store(windows + i, _mm256_setzero_si256());
+        }
+
+        size_t offset = 0;
+        for (size_t run = 1; run <= token_size; run *= 2)
+        {
+            if (token_size & run)
+            {
+                for (size_t i = 0; i < BLOCK; i += 8)
+                {
+                    store(windows + i, _mm256_xor_si256(load(windows + i), load(runs + offset + i)));
+                }
+                offset += run;
+            }
+
+            if (run * 2 <= token_size)
+            {
+                // In place is safe; each entry only reads entries after it
+                for (size_t i = 0; i < SPAN; i += 8)
+                {
+                    store(runs + i, _mm256_xor_si256(load(runs + i), load(runs + i + run)));
+                }
+            }
+        }
+
+        for (size_t i = 0; i < BLOCK; i += 8)
+        {
+            const __m256i window = load(windows + i);
+            const __m256i low    = _mm256_shuffle_epi8(pop_table, _mm256_and_si256(window, low_bits));
+            const __m256i high   = _mm256_shuffle_epi8(pop_table, _mm256_and_si256(_mm256_srli_epi16(window, 4), low_bits));
+            const __m256i counts = _mm256_madd_epi16(_mm256_maddubs_epi16(_mm256_add_epi8(low, high), byte_ones),
+                                                     _mm256_set1_epi16(1));
+
+            const int found = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(counts, expected)));
+            if (found)
+            {
+                return pos + i + __builtin_ctz(found) + token_size;
+            }
+        }
+    }
+
+    // Less than a block left
+    const auto tail = find_token_sliding(begin + pos, end, token_size);
+    return tail == NOT_FOUND ? tail : pos + tail;
+}
+#endif
+
+template <class MaskT> std::array<MaskT, 256> make_masks(unsigned char base, unsigned char last)
+{
+    std::array<MaskT, 256> masks = {{0}};
+    for (unsigned c = base; c <= last; ++c)
+    {
+        masks[c] = MaskT(1) << (c - base);
+    }
+    return masks;
+}
+
+// Pick the fastest search for the alphabet actually used by the data; small
+// alphabets can use the bitmask search (vectorized if possible), anything else
+// falls back to find_token_sliding
+size_t find_token_by_alphabet(const char* begin, const char* end, size_t token_size)
+{
+    if (begin == end)
+    {
+        return NOT_FOUND;
+    }
+
+    unsigned char base, last;
+#ifdef DAY_6_AVX2
+    if (advent::has_avx2())
+    {
+        std::tie(base, last) = byte_range_avx2(begin, end);
+    }
+    else
+#endif
+    {
+        const auto bounds = std::minmax_element(reinterpret_cast<const unsigned char*>(begin), reinterpret_cast<const unsigned char*>(end));
+        base              = *bounds.first;
+        last              = *bounds.second;
+    }
+    const size_t symbols = last - base + 1U;
+
+    if (token_size > symbols)
+    {
+        return NOT_FOUND;
+    }
+
+    if (symbols <= 32)
+    {
+#ifdef DAY_6_AVX2
+        if (advent::has_avx2())
+        {
+            return find_token_bitmask_avx2(begin, end, token_size, base);
+        }
+#endif
+        return find_token_bitmask(begin, end, token_size, make_masks<uint32_t>(base, last));
+    }
+
+    if (symbols <= 64)
+    {
+        return find_token_bitmask(begin, end, token_size, make_masks<uint64_t>(base, last));
+    }
+
+    return find_token_sliding(begin, end, token_size);
+}
+
+// find_token_by_alphabet a block at a time, so the alphabet is only measured
+// over data that is searched and an early marker is found without reading the
+// rest of the buffer. Blocks overlap the next by token_size - 1 so windows
+// crossing a boundary are seen.
+size_t find_token_fast(const char* begin, const char* end, size_t token_size, size_t block_size = 1 << 16)
+{
+    if (token_size == 0)
+    {
+        return 0;
+    }
+
+    const auto size = static_cast<size_t>(end - begin);
+    for (size_t block = 0; block < size; block += block_size)
+    {
+        const size_t block_end = std::min(size, block + block_size + token_size - 1);
+        const auto found       = find_token_by_alphabet(begin + block, begin + block_end, token_size);
+        if (found != NOT_FOUND)
+        {
+            return block + found;
+        }
+        if (block_end == size)
+        {
+            break;
+        }
+    }
+    return NOT_FOUND;
+}
+
+// find_token_fast over a buffer already in memory (e.g. a mapped file), split
+// between workers. Each worker owns the windows starting in one chunk, and
+// searches them a slice at a time; slices overlap the next by token_size - 1
+// so windows crossing a boundary are seen. Workers stop as soon as a marker
+// has been found that ends before anything their next slice could find.
+size_t find_token_parallel(const char* begin, const char* end, size_t token_size, size_t workers,
+                           size_t slice_size = 1 << 20)
+{
+    const auto size = static_cast<size_t>(end - begin);
+    if (workers <= 1 || size <= slice_size)
+    {
+        return find_token_fast(begin, end, token_size);
+    }
+
+    std::atomic<size_t> best(NOT_FOUND);
+    const auto search = [&](size_t chunk_begin, size_t chunk_end)
+    {
+        for (size_t slice = chunk_begin; slice < chunk_end; slice += slice_size)
+        {
+            // Anything in this slice ends at slice + token_size or later
+            if (best.load(std::memory_order_relaxed) <= slice + token_size)
+            {
+                return;
+            }
+
+            const auto slice_end = std::min(std::min(slice + slice_size, chunk_end) + token_size - 1, size);
+            const auto found     = find_token_fast(begin + slice, begin + slice_end, token_size);
+            if (found != NOT_FOUND)
+            {
+                auto current = best.load();
+                while (slice + found < current && !best.compare_exchange_weak(current, slice + found))
+                    ;
+                return;
+            }
+        }
+    };
+
+    advent::parallel_ranges(size, workers, search);
+    return best;
+}
+
+// Finds markers of several sizes in a single pass over a datastream that is fed
+// in blocks. A marker of size n ends wherever the duplicate-free run ending
+// there is at least n long, so all sizes share one run; the only history kept
+// between blocks is where each byte was last seen.
+class MarkerScanner
+{
+  public:
+    explicit MarkerScanner(std::vector<size_t> token_sizes)
+        : m_token_sizes(std::move(token_sizes)), m_first(m_token_sizes.size(), NOT_FOUND)
+    {
+        assert(std::find(m_token_sizes.begin(), m_token_sizes.end(), 0) == m_token_sizes.end());
+        m_smallest = m_token_sizes.empty() ? NOT_FOUND : *std::min_element(m_token_sizes.begin(), m_token_sizes.end());
+    }
+
+    // Scan the next block, calling on_marker(token_size, position) for every
+    // marker ending in it; positions count from the start of the stream and are
+    // the same as the ones find_token returns
+    template <class F> void feed(const char* begin, const char* end, const F& on_marker)
+    {
+        for (; begin != end; ++begin)
+        {
+            auto& last     = m_last_seen[static_cast<unsigned char>(*begin)];
+            m_run_start    = std::max(m_run_start, last);
+            last           = ++m_position;
+            const auto run = m_position - m_run_start;
+
+            if (run < m_smallest)
+            {
+                continue;
+            }
+
+            for (size_t i = 0; i < m_token_sizes.size(); ++i)
+            {
+                if (run >= m_token_sizes[i])
+                {
+                    if (m_first[i] == NOT_FOUND)
+                    {
+                        m_first[i] = m_position;
+                    }
+                    on_marker(m_token_sizes[i], m_position);
+                }
+            }
+        }
+    }
+
+    void feed(const char* begin, const char* end)
+    {
+        feed(begin, end, [](size_t, size_t) {});
+    }
+
+    // First marker position for each token size, in the order they were given
+    const std::vector<size_t>& first() const { return m_first; }
+
+    bool found_all() const
+    {
+        return std::find(m_first.begin(), m_first.end(), NOT_FOUND) == m_first.end();
+    }
+
+  private:
+    std::vector<size_t> m_token_sizes;
+    std::vector<size_t> m_first;
+    size_t m_smallest;
+
+    // Position + 1 of the last occurrence of each byte; 0 is never seen
+    std::array<size_t, 256> m_last_seen = {{0}};
+    size_t m_run_start                  = 0;
+    size_t m_position                   = 0;
+};
+
+// Feed the first line of a stream through scanner one block at a time; reading
+// stops at the end of the line, or as soon as stop() is true
+template <class F, class StopF>
+void scan_stream(std::istream& in, MarkerScanner& scanner, const F& on_marker, const StopF& stop, size_t block_size)
+{
+    std::vector<char> block(block_size);
+    while (!stop())
+    {
+        in.read(block.data(), block.size());
+
+        const auto block_end = block.data() + in.gcount();
+        const auto line_end  = std::find(block.data(), block_end, '\n');
+        scanner.feed(block.data(), line_end, on_marker);
+
+        if (line_end != block_end || !in)
+        {
+            break;
+        }
+    }
+}
+
+// First marker position for each of token_sizes, without holding the stream in memory
+std::vector<size_t> find_tokens(std::istream& in, const std::vector<size_t>& token_sizes, size_t block_size = 1 << 16)
+{
+    MarkerScanner scanner(token_sizes);
+    scan_stream(
+        in, scanner, [](size_t, size_t) {}, [&] { return scanner.found_all(); }, block_size);
+    return scanner.first();
+}
+
+// Call on_marker(token_size, position) for every marker of each of token_sizes in the stream
+template <class F>
+void for_each_token(std::istream& in, const std::vector<size_t>& token_sizes, const F& on_marker, size_t block_size = 1 << 16)
+{
+    MarkerScanner scanner(token_sizes);
+    scan_stream(
+        in, scanner, on_marker, [] { return false; }, block_size);
+}
+
+// Write the start of every marker in [begin, end) to out, up to capacity of
+// them; returns the total number of markers, which may be more than capacity.
+// A start is the position MarkerScanner reports less token_size.
+size_t find_all_tokens(const char* begin, const char* end, size_t token_size, size_t* out, size_t capacity)
+{
+    size_t count = 0;
+
+    MarkerScanner scanner({token_size});
+    scanner.feed(begin, end,
+                 [&](size_t, size_t position)
+                 {
+                     if (count < capacity)
+                     {
+                         out[count] = position - token_size;
+                     }
+                     ++count;
+                 });
+    return count;
+}
+
+std::string random_datastream(size_t size, char first, char last, unsigned seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<int> dist(first, last);
+
+    std::string result(size, '\0');
+    for (auto& c : result)
+    {
+        c = static_cast<char>(dist(gen));
+    }
+    return result;
 }
 }
 
@@ -37,18 +509,14 @@ void day_6(std::istream& input, std::ostream& output)
 {
     using namespace day_6_impl;
 
-    std::string line;
-    std::getline(input, line);
-    output << find_token(line.begin(), line.end(), 4);
+    output << find_tokens(input, {4}).front();
 }
 
 void day_6_adv(std::istream& input, std::ostream& output)
 {
     using namespace day_6_impl;
 
-    std::string line;
-    std::getline(input, line);
-    output << find_token(line.begin(), line.end(), 14);
+    output << find_tokens(input, {14}).front();
 }
 
 TEST(Day6, Examples)
@@ -82,3 +550,238 @@ TEST(Day6, ExamplesAdvanced)
         EXPECT_EQ(find_token(test.first.begin(), test.first.end(), 14), test.second);
     }
 }
+
+TEST(Day6, SlidingWindow)
+{
+    using namespace day_6_impl;
+
+    const std::vector<std::tuple<std::string, size_t, size_t>> CASES {{"mjqjpqmgbljsphdztnvjfqwrcgsmlb", 4, 7},
+                                                                      {"nznrnfrfntjfmvfwmzdfjlvtqnbhcprsg", 14, 29},
+                                                                      {"aabcd", 4, 5},
+                                                                      {"abcabc", 4, NOT_FOUND},
+                                                                      {"", 4, NOT_FOUND},
+                                                                      {"abc", 0, 0}};
+
+    for (const auto& test : CASES)
+    {
+        const auto& data = std::get<0>(test);
+        EXPECT_EQ(find_token_sliding(data.begin(), data.end(), std::get<1>(test)), std::get<2>(test)) << data;
+    }
+}
+
+TEST(Day6, BitmaskMatchesSliding)
+{
+    using namespace day_6_impl;
+
+    // Alphabets small enough for 32 and 64 bit masks, and one that is not
+    const std::vector<std::pair<char, char>> ALPHABETS {{'a', 'd'}, {'a', 'z'}, {'0', 'o'}, {'!', '~'}};
+
+    unsigned seed = 0;
+    for (const auto& alphabet : ALPHABETS)
+    {
+        for (const size_t token_size : {1, 4, 14, 20})
+        {
+            const auto data     = random_datastream(2000, alphabet.first, alphabet.second, ++seed);
+            const auto expected = find_token_sliding(data.begin(), data.end(), token_size);
+
+            const auto first = data.data();
+            const auto last  = first + data.size();
+            const auto base  = static_cast<unsigned char>(alphabet.first);
+            const auto top   = static_cast<unsigned char>(alphabet.second);
+
+            EXPECT_EQ(find_token_fast(first, last, token_size), expected) << alphabet.first << " " << token_size;
+            if (top - base < 64)
+            {
+                EXPECT_EQ(find_token_bitmask(first, last, token_size, make_masks<uint64_t>(base, top)), expected);
+            }
+#ifdef DAY_6_AVX2
+            if (top - base < 32 && advent::has_avx2())
+            {
+                EXPECT_EQ(find_token_bitmask_avx2(first, last, token_size, base), expected);
+            }
+#endif
+        }
+    }
+
+    // Marker far past the first block
+    std::string late(5000, 'a');
+    for (size_t i = 0; i < late.size(); i += 2)
+    {
+        late[i] = 'b';
+    }
+    late += "cdefghijklmnop";
+    for (const size_t token_size : {4, 14})
+    {
+        EXPECT_EQ(find_token_fast(late.data(), late.data() + late.size(), token_size),
+                  find_token_sliding(late.begin(), late.end(), token_size));
+    }
+
+    // Every token size a 32 symbol alphabet allows, with a marker planted at
+    // different points of a block, and searched in blocks of several sizes
+    std::string symbols;
+    for (char c = 'A'; c <= '`'; ++c)
+    {
+        symbols += c;
+    }
+    for (size_t token_size = 1; token_size <= 32; ++token_size)
+    {
+        for (const size_t at : {0, 100, 250, 286, 700})
+        {
+            // Alternating symbols only hold markers of one or two, so for
+            // anything longer the planted one is first
+            std::string data(1000, 'A');
+            for (size_t i = 0; i < data.size(); i += 2)
+            {
+                data[i] = 'B';
+            }
+            std::copy(symbols.begin(), symbols.begin() + token_size, data.begin() + at);
+
+            const auto expected = find_token_sliding(data.begin(), data.end(), token_size);
+            const auto first    = data.data();
+            const auto last     = first + data.size();
+            if (token_size > 2)
+            {
+                ASSERT_EQ(expected, at + token_size);
+            }
+
+            EXPECT_EQ(find_token_bitmask(first, last, token_size, make_masks<uint32_t>('A', '`')), expected) << token_size;
+            for (const size_t block_size : {1, 64, 1 << 16})
+            {
+                EXPECT_EQ(find_token_fast(first, last, token_size, block_size), expected) << token_size << " " << block_size;
+            }
+#ifdef DAY_6_AVX2
+            if (advent::has_avx2())
+            {
+                EXPECT_EQ(find_token_bitmask_avx2(first, last, token_size, 'A'), expected) << token_size << " at " << at;
+            }
+#endif
+        }
+    }
+}
+
+TEST(Day6, StreamingScanner)
+{
+    using namespace day_6_impl;
+
+    const auto data = random_datastream(3000, 'a', 'p', 1234);
+
+    for (const size_t block_size : {1, 3, 64, 1 << 16})
+    {
+        std::stringstream ss_in;
+        ss_in << data << "\nzyxwvutsrqponmlkjihgfedcba";
+
+        const auto first = find_tokens(ss_in, {14, 4, 10}, block_size);
+        EXPECT_EQ(first, std::vector<size_t>({find_token_sliding(data.begin(), data.end(), 14),
+                                              find_token_sliding(data.begin(), data.end(), 4),
+                                              find_token_sliding(data.begin(), data.end(), 10)}));
+    }
+
+    std::stringstream ss_in;
+    ss_in << data;
+
+    std::vector<std::pair<size_t, size_t>> markers;
+    for_each_token(ss_in, {4, 10}, [&](size_t token_size, size_t position) { markers.emplace_back(token_size, position); }, 7);
+
+    std::vector<std::pair<size_t, size_t>> expected;
+    for (size_t position = 1; position <= data.size(); ++position)
+    {
+        for (const size_t token_size : {4, 10})
+        {
+            if (position >= token_size && day_6_impl::unique(data.begin() + (position - token_size), data.begin() + position))
+            {
+                expected.emplace_back(token_size, position);
+            }
+        }
+    }
+    EXPECT_EQ(markers, expected);
+}
+
+TEST(Day6, ParallelSearch)
+{
+    using namespace day_6_impl;
+
+    // Marker only near the end, and one straddling the boundary of two slices
+    std::string data(10000, 'a');
+    for (size_t i = 0; i < data.size(); i += 2)
+    {
+        data[i] = 'b';
+    }
+
+    auto late = data;
+    late.replace(late.size() - 20, 14, "cdefghijklmnop");
+
+    auto straddling = data;
+    straddling.replace(1020, 14, "cdefghijklmnop");
+
+    for (const auto& test : {data, late, straddling, random_datastream(10000, 'a', 'z', 29)})
+    {
+        for (const size_t token_size : {4, 14})
+        {
+            for (const size_t workers : {1, 2, 3, 8})
+            {
+                EXPECT_EQ(find_token_parallel(test.data(), test.data() + test.size(), token_size, workers, 1024),
+                          find_token_sliding(test.begin(), test.end(), token_size))
+                    << token_size << " " << workers;
+            }
+        }
+    }
+}
+
+TEST(Day6, FinalWindow)
+{
+    using namespace day_6_impl;
+
+    const std::string data = "aabcd";
+    EXPECT_EQ(find_token(data.begin(), data.end(), 4), 5);
+    EXPECT_EQ(find_token(data.begin(), data.end(), 5), NOT_FOUND);
+}
+
+TEST(Day6, AllTokens)
+{
+    using namespace day_6_impl;
+
+    const std::string data = "abcabcdd";
+
+    std::vector<size_t> starts(data.size());
+    starts.resize(find_all_tokens(data.data(), data.data() + data.size(), 3, starts.data(), starts.size()));
+    EXPECT_EQ(starts, std::vector<size_t>({0, 1, 2, 3, 4}));
+
+    // More markers than fit in the buffer
+    std::vector<size_t> buffer(2);
+    EXPECT_EQ(find_all_tokens(data.data(), data.data() + data.size(), 3, buffer.data(), buffer.size()), 5);
+    EXPECT_EQ(buffer, std::vector<size_t>({0, 1}));
+
+    const auto random_data = random_datastream(5000, 'a', 'r', 7);
+
+    std::vector<size_t> expected;
+    for (size_t start = 0; start + 10 <= random_data.size(); ++start)
+    {
+        if (day_6_impl::unique(random_data.begin() + start, random_data.begin() + start + 10))
+        {
+            expected.push_back(start);
+        }
+    }
+
+    buffer.resize(random_data.size());
+    buffer.resize(find_all_tokens(random_data.data(), random_data.data() + random_data.size(), 10, buffer.data(), buffer.size()));
+    EXPECT_EQ(buffer, expected);
+}
+
+// Not run by default; use --gtest_also_run_disabled_tests
+TEST(Day6, DISABLED_BenchmarkAllTokens)
+{
+    using namespace day_6_impl;
+
+    const auto data = random_datastream(size_t(1) << 28, 'a', 'z', 42);
+    std::vector<size_t> buffer(data.size());
+
+    for (const size_t token_size : {4, 14})
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const auto count = find_all_tokens(data.data(), data.data() + data.size(), token_size, buffer.data(), buffer.size());
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        std::cout << "token size " << token_size << ": " << count << " markers, "
+                  << static_cast<double>(data.size()) / elapsed.count() / (1 << 20) << " MiB/s" << std::endl;
+    }
+}
@@ -1,4 +1,15 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 #include <queue>
@@ -6,8 +17,17 @@
 
 #include <gtest/gtest.h>
 
+#include "parallel.h"
+
 #include <cassert>
 
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace day_7_impl
 {
 struct File
@@ -36,21 +56,88 @@ struct Command
     std::vector<File> ls_files;
 };
 
+// Walk the tree rooted at root in post-order, calling f on every directory
+// after all of its subdirectories. Subdirectories of a directory are skipped
+// unless descend(directory) is true. Uses the parent links instead of
+// recursion or a stack, so works for any depth without allocating.
+template <class TreeT, class F, class DescendF> void visit_post_order(TreeT& root, const F& f, const DescendF& descend)
+{
+    const auto first_leaf = [&](TreeT* node)
+    {
+        while (!node->subdirs().empty() && descend(*node))
+        {
+            node = node->subdirs().front();
+        }
+        return node;
+    };
+
+    TreeT* node = first_leaf(&root);
+    while (true)
+    {
+        f(*node);
+        if (node == &root)
+        {
+            break;
+        }
+
+        auto* sibling = node->next_sibling();
+        node          = sibling ? first_leaf(sibling) : node->parent();
+    }
+}
+
+template <class TreeT, class F> void visit_post_order(TreeT& root, const F& f)
+{
+    visit_post_order(root, f, [](const TreeT&) { return true; });
+}
+
 class FileTree
 {
   public:
     FileTree(const std::string& dirname, FileTree* parent = nullptr) : m_parent(parent), m_name(dirname) { }
 
+    // Subdirectories are torn down from a list rather than by each one's
+    // destructor in turn, which would overflow the stack on very deep trees
+    ~FileTree()
+    {
+        std::vector<std::unique_ptr<FileTree>> pending;
+        const auto take_children = [&](FileTree& node)
+        {
+            for (auto& subdir_pair : node.m_children)
+            {
+                if (subdir_pair.second)
+                {
+                    pending.push_back(std::move(subdir_pair.second));
+                }
+            }
+        };
+
+        take_children(*this);
+        while (!pending.empty())
+        {
+            auto node = std::move(pending.back());
+            pending.pop_back();
+            take_children(*node);
+        }
+    }
+
     const std::string& name() const { return m_name; }
 
     // Get the parent in the tree
     FileTree* parent() const { return m_parent; }
 
+    // Get the next subdirectory of the parent, in creation order; null if this is the last one
+    FileTree* next_sibling() const
+    {
+        if (!m_parent || m_index + 1 == m_parent->m_subdirs.size())
+        {
+            return nullptr;
+        }
+        return m_parent->m_subdirs[m_index + 1];
+    }
+
     // Get a child of this dir; if it does not exist, it is created
     FileTree* child(const std::string& child_name)
     {
-        m_dirty = true;
-
         auto child_it = m_children.find(child_name);
         if (child_it == m_children.end())
         {
@@ -58,6 +145,8 @@ class FileTree
             std::tie(child_it, dummy) = m_children.emplace(child_name, std::make_unique<FileTree>(child_name, this));
             assert(dummy == true);
 
+            child_it->second->m_index = m_subdirs.size();
+            m_subdirs.push_back(child_it->second.get());
             m_children_names.push_back(child_name);
         }
         return child_it->second.get();
@@ -73,7 +162,10 @@ class FileTree
         return child_it->second.get();
     }
 
-    std::vector<std::string> children() const { return m_children_names; }
+    const std::vector<std::string>& children() const { return m_children_names; }
+
+    // Subdirectories, in the same order as children()
+    const std::vector<FileTree*>& subdirs() const { return m_subdirs; }
 
     void add_file(const std::string& name, size_t size)
     {
@@ -85,39 +177,31 @@ class FileTree
         }
 
         m_files[name] = size;
-        m_files_size += size;
-
-        m_dirty = true;
-    }
 
-    size_t size() const
-    {
-        if (m_dirty)
+        // Every directory up to the root contains the new file
+        for (FileTree* dir = this; dir; dir = dir->m_parent)
         {
-            m_calculated_size = m_files_size;
-            for (const auto& subdir_pair : m_children)
-            {
-                m_calculated_size += subdir_pair.second->size();
-            }
-
-            m_dirty = false;
+            dir->m_size += size;
         }
-
-        return m_calculated_size;
     }
 
+    // Total size of the files in this directory and all subdirectories; always
+    // up to date, since add_file keeps it so
+    size_t size() const { return m_size; }
+
   private:
     FileTree* m_parent;
     std::string m_name;
 
+    // Position in the parent's m_subdirs
+    size_t m_index = 0;
+
     std::unordered_map<std::string, std::unique_ptr<FileTree>> m_children;
     std::vector<std::string> m_children_names;
+    std::vector<FileTree*> m_subdirs;
 
     std::unordered_map<std::string, size_t> m_files;
-    size_t m_files_size = 0;
-
-    mutable size_t m_calculated_size = 0;
-    mutable bool m_dirty             = true;
+    size_t m_size = 0;
 };
 
 bool operator==(const File& l, const File& r)
@@ -131,69 +215,148 @@ bool operator==(const Command& l, const Command& r)
            ((l.type == Command::Type::CD && l.cd_arg == r.cd_arg) || (l.type == Command::Type::LS && l.ls_files == r.ls_files));
 }
 
-std::vector<std::string> split(const std::string& text)
+// One line of a transcript; name is a view into the transcript text
+struct Token
+{
+    enum class Type
+    {
+        CD,
+        LS,
+        DIR,
+        FILE
+    };
+
+    Type type;
+    std::string_view name;
+    size_t size = 0;
+};
+
+// Splits transcript text into Tokens, a line at a time, without copying it
+class Tokenizer
 {
-    std::vector<std::string> result;
+  public:
+    explicit Tokenizer(std::string_view text) : m_text(text) { }
 
-    auto start = text.begin();
-    for (auto it = text.begin(); it != text.end(); ++it)
+    // Read the next non-empty line; false at the end of the text
+    bool next(Token& token)
     {
-        if (*it == ' ')
+        while (m_pos < m_text.size())
         {
-            result.emplace_back(start, it);
-            start = it + 1;
+            const auto line_end = std::min(m_text.find('\n', m_pos), m_text.size());
+            auto line           = m_text.substr(m_pos, line_end - m_pos);
+            m_pos               = line_end + 1;
+
+            if (!line.empty() && line.back() == '\r')
+            {
+                line.remove_suffix(1);
+            }
+            if (line.empty())
+            {
+                continue;
+            }
+
+            if (line.substr(0, 5) == "$ cd ")
+            {
+                token = Token {Token::Type::CD, line.substr(5)};
+            }
+            else if (line == "$ ls")
+            {
+                token = Token {Token::Type::LS, {}};
+            }
+            else if (line.substr(0, 4) == "dir ")
+            {
+                token = Token {Token::Type::DIR, line.substr(4)};
+            }
+            else
+            {
+                token = Token {Token::Type::FILE, {}, 0};
+
+                size_t i = 0;
+                for (; i < line.size() && line[i] >= '0' && line[i] <= '9'; ++i)
+                {
+                    token.size = token.size * 10 + (line[i] - '0');
+                }
+                token.name = line.substr(std::min(i + 1, line.size()));
+            }
+            return true;
         }
+        return false;
     }
-    result.emplace_back(start, text.end());
 
-    return result;
-}
+    // Offset in the text of the next line to be read
+    size_t position() const { return std::min(m_pos, m_text.size()); }
 
-std::vector<Command> read_input(std::istream& stream)
+  private:
+    std::string_view m_text;
+    size_t m_pos = 0;
+};
+
+// A command as spans of the transcript text: the argument of a cd, or the
+// lines listed by an ls (which can be read with a Tokenizer)
+struct CommandView
 {
-    std::vector<Command> commands;
+    Command::Type type;
+    std::string_view cd_arg;
+    std::string_view listing;
+};
 
-    assert(stream.peek() == '$');
-    std::string line;
+// Splits transcript text into CommandViews without copying it
+class CommandReader
+{
+  public:
+    explicit CommandReader(std::string_view text) : m_text(text), m_tokens(text) { }
 
-    while (stream)
+    // Read the next command; false at the end of the text
+    bool next(CommandView& command)
     {
-        Command next_command;
-        if (!std::getline(stream, line))
+        Token token;
+        if (!m_tokens.next(token))
         {
-            break;
+            return false;
         }
+        assert(token.type == Token::Type::CD || token.type == Token::Type::LS);
 
-        const auto parts = split(line);
-        assert(parts[0] == "$");
-
-        if (parts[1] == "cd")
+        if (token.type == Token::Type::CD)
         {
-            next_command.type   = Command::Type::CD;
-            next_command.cd_arg = parts[2];
+            command = CommandView {Command::Type::CD, token.name, {}};
+            return true;
         }
-        else if (parts[1] == "ls")
-        {
-            next_command.type = Command::Type::LS;
 
-            while (stream && stream.peek() != '$')
-            {
-                std::getline(stream, line);
-                const auto parts = split(line);
+        // The listing runs up to the next line starting with a $, which may be
+        // the very next line
+        const auto listing_start = m_tokens.position();
+        const auto listing_end   = std::max(std::min(m_text.find("\n$", listing_start - 1), m_text.size()), listing_start);
 
-                File f;
-                f.name = parts[1];
-                if (parts[0] == "dir")
-                {
-                    f.type = File::Type::DIR;
-                }
-                else
-                {
-                    f.type = File::Type::FILE;
-                    f.size = std::stoull(parts[0]);
-                }
-                next_command.ls_files.push_back(std::move(f));
-            }
+        command  = CommandView {Command::Type::LS, {}, m_text.substr(listing_start, listing_end - listing_start)};
+        m_tokens = Tokenizer(m_text.substr(listing_end));
+        m_text   = m_text.substr(listing_end);
+        return true;
+    }
+
+  private:
+    std::string_view m_text;
+    Tokenizer m_tokens;
+};
+
+std::vector<Command> read_input(std::istream& stream)
+{
+    const std::string text {std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>()};
+
+    std::vector<Command> commands;
+
+    CommandReader reader(text);
+    CommandView view;
+    while (reader.next(view))
+    {
+        Command next_command {view.type, std::string(view.cd_arg), {}};
+
+        Tokenizer listing(view.listing);
+        Token entry;
+        while (listing.next(entry))
+        {
+            assert(entry.type == Token::Type::DIR || entry.type == Token::Type::FILE);
+            next_command.ls_files.push_back(
+                File {entry.type == Token::Type::DIR ? File::Type::DIR : File::Type::FILE, std::string(entry.name), entry.size});
         }
         commands.push_back(std::move(next_command));
     }
@@ -241,117 +404,1322 @@ std::unique_ptr<FileTree> build_tree(const std::vector<Command>& commands)
     return result;
 }
 
+// Call f on every directory in pre-order; like visit_post_order, this follows
+// the parent links rather than recursing
 template <class F> void visit(const FileTree& tree, const F& f)
 {
-    f(tree);
-
-    for (const auto& c : tree.children())
+    const FileTree* node = &tree;
+    while (true)
     {
-        visit(*tree.child(c), f);
+        f(*node);
+
+        if (!node->subdirs().empty())
+        {
+            node = node->subdirs().front();
+            continue;
+        }
+
+        while (node != &tree && !node->next_sibling())
+        {
+            node = node->parent();
+        }
+
+        if (node == &tree)
+        {
+            break;
+        }
+        node = node->next_sibling();
     }
 }
 
-TEST(Day7, SplitString)
+// The size of every directory, in post-order (so the root is last)
+std::vector<size_t> directory_sizes(const FileTree& tree)
 {
-    EXPECT_EQ(split("$ cd .."), std::vector<std::string>({"$", "cd", ".."}));
-    EXPECT_EQ(split("$ ls"), std::vector<std::string>({"$", "ls"}));
-    EXPECT_EQ(split("abcd"), std::vector<std::string>({"abcd"}));
+    std::vector<size_t> result;
+    visit_post_order(tree, [&](const FileTree& ft) { result.push_back(ft.size()); });
+    return result;
 }
 
-TEST(Day7, ParseInput)
+// The same tree as FileTree, flattened: every directory is a node in one
+// vector, linked by index to its parent, first child and next sibling, and all
+// names are stored back to back in one string. Children are found through an
+// open-addressed table keyed on (parent, name) instead of a map per directory.
+//
+// Only the total size of the files directly in a directory is kept; a
+// directory listed more than once is only counted the first time.
+class FlatFileTree
 {
-    const static char* INPUT_DATA = R"in($ cd /
-$ cd abc
-$ ls
-dir a
-dir b
-1234 file.txt
-5678 other_file
-$ cd /)in";
+  public:
+    using Index                 = uint32_t;
+    static constexpr Index NONE = static_cast<Index>(-1);
 
-    std::stringstream ss_in;
-    ss_in << INPUT_DATA;
+    struct Node
+    {
+        Index parent;
+        Index first_child  = NONE;
+        Index next_sibling = NONE;
 
-    const auto commands = read_input(ss_in);
+        uint32_t name_offset;
+        uint32_t name_size;
 
-    ASSERT_EQ(commands.size(), 4U);
-    EXPECT_EQ(commands[0], Command({Command::Type::CD, "/", {}}));
-    EXPECT_EQ(commands[1], Command({Command::Type::CD, "abc", {}}));
-    EXPECT_EQ(commands[2], Command({Command::Type::LS,
-                                    "",
-                                    {File({File::Type::DIR, "a", 0}), File({File::Type::DIR, "b", 0}),
-                                     File({File::Type::FILE, "file.txt", 1234}), File({File::Type::FILE, "other_file", 5678})}}));
-    EXPECT_EQ(commands[3], Command({Command::Type::CD, "/", {}}));
-}
+        bool listed       = false;
+        size_t files_size = 0;
 
-TEST(Day7, BuildTreeSimple)
-{
-    std::vector<Command> commands {Command {Command::Type::LS, "", {File {File::Type::FILE, "a", 10}, File {File::Type::FILE, "b", 20}}}};
-    auto tree = build_tree(commands);
+        // Including subdirectories; only valid after compute_sizes()
+        size_t size = 0;
+    };
 
-    EXPECT_EQ(tree->children().size(), 0);
-    EXPECT_EQ(tree->size(), 30);
-}
+    FlatFileTree() : m_lookup(16, NONE)
+    {
+        add_node(NONE, "/");
+    }
 
-TEST(Day7, BuildTreeNested)
-{
-    std::vector<Command> commands {
-        Command {
-            Command::Type::LS, "", {File {File::Type::DIR, "x", 0}, File {File::Type::FILE, "a", 10}, File {File::Type::FILE, "b", 20}}},
-        Command {Command::Type::CD, "x", {}}, Command {Command::Type::LS, "", {File {File::Type::FILE, "a", 30}}}};
+    Index root() const { return 0; }
+    Index parent(Index dir) const { return m_nodes[dir].parent; }
+    size_t size(Index dir) const { return m_nodes[dir].size; }
 
-    auto tree = build_tree(commands);
+    std::string name(Index dir) const { return m_names.substr(m_nodes[dir].name_offset, m_nodes[dir].name_size); }
 
-    ASSERT_EQ(tree->children().size(), 1);
-    EXPECT_EQ(tree->children()[0], "x");
-    EXPECT_EQ(tree->size(), 60);
+    const std::vector<Node>& nodes() const { return m_nodes; }
 
-    auto sub_tree = tree->child("x");
-    EXPECT_EQ(sub_tree->children().size(), 0);
-    EXPECT_EQ(sub_tree->size(), 30);
-}
-}
+    // Get a child of dir; if it does not exist, it is created
+    Index child(Index dir, std::string_view child_name)
+    {
+        auto& slot = lookup_slot(dir, child_name);
+        if (slot != NONE)
+        {
+            return slot;
+        }
 
-void day_7(std::istream& input, std::ostream& output)
-{
-    using namespace day_7_impl;
+        const auto index = add_node(dir, child_name);
+        slot             = index;
 
-    const auto commands = read_input(input);
-    const auto tree     = build_tree(commands);
+        // Keep the table at most half full
+        if (m_nodes.size() * 2 > m_lookup.size())
+        {
+            rehash();
+        }
+        return index;
+    }
 
-    size_t sum_size = 0;
-    visit(*tree,
-          [&](const FileTree& ft)
-          {
-              if (ft.size() <= 100000)
-              {
-                  sum_size += ft.size();
-              }
-          });
+    // NONE if dir has no such child
+    Index find_child(Index dir, std::string_view child_name) const
+    {
+        return const_cast<FlatFileTree*>(this)->lookup_slot(dir, child_name);
+    }
 
-    output << sum_size;
-}
+    // Record the listing of dir, given the total size of the files in it
+    void list(Index dir, size_t files_size)
+    {
+        auto& node = m_nodes[dir];
+        if (!node.listed)
+        {
+            node.listed     = true;
+            node.files_size = files_size;
+        }
+    }
 
-void day_7_adv(std::istream& input, std::ostream& output)
-{
-    using namespace day_7_impl;
+    // Children are always created after their parent, so walking backwards
+    // finishes every subtree before its parent is reached
+    void compute_sizes()
+    {
+        for (auto& node : m_nodes)
+        {
+            node.size = node.files_size;
+        }
 
-    const auto commands = read_input(input);
-    const auto tree     = build_tree(commands);
+        for (size_t i = m_nodes.size() - 1; i > 0; --i)
+        {
+            m_nodes[m_nodes[i].parent].size += m_nodes[i].size;
+        }
+    }
 
-    size_t required_space = 30000000 - (70000000 - tree->size());
+  private:
+    Index add_node(Index parent, std::string_view node_name)
+    {
+        assert(m_nodes.size() < NONE && m_names.size() + node_name.size() <= UINT32_MAX);
 
-    size_t smallest_match = 70000000;
-    visit(*tree,
-          [&](const FileTree& ft)
-          {
-              if (ft.size() >= required_space && ft.size() < smallest_match)
-              {
-                  smallest_match = ft.size();
-              }
-          });
+        Node node;
+        node.parent      = parent;
+        node.name_offset = static_cast<uint32_t>(m_names.size());
+        node.name_size   = static_cast<uint32_t>(node_name.size());
+        m_names += node_name;
+
+        const auto index = static_cast<Index>(m_nodes.size());
+        if (parent != NONE)
+        {
+            node.next_sibling           = m_nodes[parent].first_child;
+            m_nodes[parent].first_child = index;
+        }
+
+        m_nodes.push_back(node);
+        return index;
+    }
+
+    size_t hash(Index parent, const char* node_name, size_t size) const
+    {
+        // FNV-1a
+        size_t result = 14695981039346656037ULL ^ parent;
+        for (size_t i = 0; i < size; ++i)
+        {
+            result = (result ^ static_cast<unsigned char>(node_name[i])) * 1099511628211ULL;
+        }
+        return result;
+    }
+
+    // The table slot holding (parent, name), or the empty slot it would go in
+    Index& lookup_slot(Index parent, std::string_view node_name)
+    {
+        const size_t mask = m_lookup.size() - 1;
+        for (size_t slot = hash(parent, node_name.data(), node_name.size()) & mask;; slot = (slot + 1) & mask)
+        {
+            const Index candidate = m_lookup[slot];
+            if (candidate == NONE)
+            {
+                return m_lookup[slot];
+            }
+
+            const auto& node = m_nodes[candidate];
+            if (node.parent == parent && node.name_size == node_name.size() &&
+                std::memcmp(m_names.data() + node.name_offset, node_name.data(), node_name.size()) == 0)
+            {
+                return m_lookup[slot];
+            }
+        }
+    }
+
+    void rehash()
+    {
+        m_lookup.assign(m_lookup.size() * 2, NONE);
+
+        const size_t mask = m_lookup.size() - 1;
+        for (Index i = 1; i < m_nodes.size(); ++i)
+        {
+            const auto& node = m_nodes[i];
+            size_t slot      = hash(node.parent, m_names.data() + node.name_offset, node.name_size) & mask;
+            while (m_lookup[slot] != NONE)
+            {
+                slot = (slot + 1) & mask;
+            }
+            m_lookup[slot] = i;
+        }
+    }
+
+    std::vector<Node> m_nodes;
+    std::string m_names;
+    std::vector<Index> m_lookup;
+};
+
+constexpr FlatFileTree::Index FlatFileTree::NONE;
+
+FlatFileTree build_flat_tree(const std::vector<Command>& commands)
+{
+    FlatFileTree result;
+    auto curr = result.root();
+    for (const Command& c : commands)
+    {
+        switch (c.type)
+        {
+        case Command::Type::CD:
+        {
+            if (c.cd_arg == "/")
+            {
+                curr = result.root();
+            }
+            else if (c.cd_arg == "..")
+            {
+                curr = result.parent(curr);
+            }
+            else
+            {
+                curr = result.child(curr, c.cd_arg);
+            }
+        }
+        break;
+        case Command::Type::LS:
+        {
+            size_t files_size = 0;
+            for (const auto& child : c.ls_files)
+            {
+                if (child.type == File::Type::FILE)
+                {
+                    files_size += child.size;
+                }
+            }
+            result.list(curr, files_size);
+        }
+        break;
+        }
+    }
+
+    result.compute_sizes();
+    return result;
+}
+
+// Same as above, but straight from the transcript text; nothing is copied out
+// of it except the names of new directories
+FlatFileTree build_flat_tree(std::string_view transcript)
+{
+    FlatFileTree result;
+    auto curr = result.root();
+
+    CommandReader reader(transcript);
+    CommandView c;
+    while (reader.next(c))
+    {
+        switch (c.type)
+        {
+        case Command::Type::CD:
+        {
+            if (c.cd_arg == "/")
+            {
+                curr = result.root();
+            }
+            else if (c.cd_arg == "..")
+            {
+                curr = result.parent(curr);
+            }
+            else
+            {
+                curr = result.child(curr, c.cd_arg);
+            }
+        }
+        break;
+        case Command::Type::LS:
+        {
+            size_t files_size = 0;
+
+            Tokenizer listing(c.listing);
+            Token entry;
+            while (listing.next(entry))
+            {
+                if (entry.type == Token::Type::FILE)
+                {
+                    files_size += entry.size;
+                }
+            }
+            result.list(curr, files_size);
+        }
+        break;
+        }
+    }
+
+    result.compute_sizes();
+    return result;
+}
+
+// A FlatFileTree saved with its subtree sizes, laid out so it can be used in
+// place (e.g. straight from a mapped file) without rebuilding the tree:
+//
+// * SnapshotHeader
+// * node_count SnapshotNodes, in FlatFileTree index order
+// * names_size bytes of names, back to back
+//
+// Integers are in host byte order.
+struct SnapshotHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t node_count;
+    uint64_t names_size;
+};
+
+struct SnapshotNode
+{
+    uint32_t parent;
+    uint32_t first_child;
+    uint32_t next_sibling;
+    uint32_t name_offset;
+    uint32_t name_size;
+    uint32_t reserved;
+    uint64_t size;
+};
+
+// Both are read and written as raw bytes, so must have no padding
+static_assert(sizeof(SnapshotHeader) == 24, "SnapshotHeader has padding");
+static_assert(sizeof(SnapshotNode) == 32, "SnapshotNode has padding");
+
+constexpr char SNAPSHOT_MAGIC[8] = {'A', 'O', 'C', '7', 'T', 'R', 'E', 'E'};
+constexpr uint32_t SNAPSHOT_VERSION = 1;
+
+void write_snapshot(std::ostream& out, const FlatFileTree& tree)
+{
+    const auto& nodes = tree.nodes();
+
+    std::string names;
+    std::vector<SnapshotNode> table;
+    table.reserve(nodes.size());
+    for (FlatFileTree::Index i = 0; i < nodes.size(); ++i)
+    {
+        const auto name = tree.name(i);
+        table.push_back(SnapshotNode {nodes[i].parent, nodes[i].first_child, nodes[i].next_sibling,
+                                      static_cast<uint32_t>(names.size()), static_cast<uint32_t>(name.size()), 0, nodes[i].size});
+        names += name;
+    }
+
+    SnapshotHeader header {};
+    std::copy(std::begin(SNAPSHOT_MAGIC), std::end(SNAPSHOT_MAGIC), header.magic);
+    header.version    = SNAPSHOT_VERSION;
+    header.node_count = static_cast<uint32_t>(table.size());
+    header.names_size = names.size();
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(SnapshotNode));
+    out.write(names.data(), names.size());
+}
+
+// Read-only view of a snapshot in memory; the memory must outlive the view.
+// The whole node table is checked once when the view is made, so a corrupt
+// or truncated file is rejected rather than read out of bounds later.
+class TreeSnapshot
+{
+  public:
+    using Index = FlatFileTree::Index;
+
+    TreeSnapshot(const char* data, size_t size) : m_data(data)
+    {
+        if (size < sizeof(SnapshotHeader))
+        {
+            throw std::runtime_error("snapshot too small");
+        }
+
+        std::memcpy(&m_header, data, sizeof(m_header));
+        if (!std::equal(std::begin(SNAPSHOT_MAGIC), std::end(SNAPSHOT_MAGIC), m_header.magic) || m_header.version != SNAPSHOT_VERSION)
+        {
+            throw std::runtime_error("not a tree snapshot");
+        }
+
+        const uint64_t table_size = uint64_t(m_header.node_count) * sizeof(SnapshotNode);
+        if (m_header.names_size > size || size - m_header.names_size != sizeof(SnapshotHeader) + table_size)
+        {
+            throw std::runtime_error("snapshot size does not match header");
+        }
+
+        validate();
+    }
+
+    Index root() const { return 0; }
+    size_t node_count() const { return m_header.node_count; }
+
+    Index parent(Index dir) const { return node(dir).parent; }
+    size_t size(Index dir) const { return node(dir).size; }
+
+    std::string name(Index dir) const
+    {
+        const auto n = node(dir);
+        return std::string(names() + n.name_offset, n.name_size);
+    }
+
+    // NONE if dir has no such child
+    Index find_child(Index dir, std::string_view child_name) const
+    {
+        for (Index child = node(dir).first_child; child != FlatFileTree::NONE;)
+        {
+            const auto n = node(child);
+            if (n.name_size == child_name.size() && std::memcmp(names() + n.name_offset, child_name.data(), n.name_size) == 0)
+            {
+                return child;
+            }
+            child = n.next_sibling;
+        }
+        return FlatFileTree::NONE;
+    }
+
+    // Call f with the size of every directory
+    template <class F> void for_each_size(const F& f) const
+    {
+        for (Index i = 0; i < m_header.node_count; ++i)
+        {
+            f(static_cast<size_t>(node(i).size));
+        }
+    }
+
+  private:
+    // Checks the links between nodes are the ones a FlatFileTree makes: there
+    // is a root, parents come before their children, and each directory's
+    // children are linked from the newest to the oldest. Following any link
+    // then stays in the table, and sibling lists always end.
+    void validate() const
+    {
+        const auto fail = [] { throw std::runtime_error("corrupt tree snapshot"); };
+
+        if (m_header.node_count == 0)
+        {
+            fail();
+        }
+
+        constexpr auto NONE = FlatFileTree::NONE;
+        for (Index i = 0; i < m_header.node_count; ++i)
+        {
+            const auto n = node(i);
+
+            if (uint64_t(n.name_offset) + n.name_size > m_header.names_size)
+            {
+                fail();
+            }
+            if (i == 0 ? n.parent != NONE : n.parent >= i)
+            {
+                fail();
+            }
+            if (n.first_child != NONE && (n.first_child <= i || n.first_child >= m_header.node_count || node(n.first_child).parent != i))
+            {
+                fail();
+            }
+            if (n.next_sibling != NONE && (n.next_sibling >= i || node(n.next_sibling).parent != n.parent))
+            {
+                fail();
+            }
+        }
+    }
+
+    SnapshotNode node(Index dir) const
+    {
+        assert(dir < m_header.node_count);
+
+        SnapshotNode result;
+        std::memcpy(&result, m_data + sizeof(SnapshotHeader) + dir * sizeof(SnapshotNode), sizeof(result));
+        return result;
+    }
+
+    const char* names() const { return m_data + sizeof(SnapshotHeader) + m_header.node_count * sizeof(SnapshotNode); }
+
+    const char* m_data;
+    SnapshotHeader m_header;
+};
+
+#ifdef __unix__
+// A whole file mapped read-only into memory
+class MappedFile
+{
+  public:
+    explicit MappedFile(const std::string& path)
+    {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw std::runtime_error("could not open " + path);
+        }
+
+        struct stat info;
+        if (::fstat(fd, &info) == 0 && info.st_size > 0)
+        {
+            m_size = static_cast<size_t>(info.st_size);
+            m_data = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        ::close(fd);
+
+        if (m_data == MAP_FAILED || !m_data)
+        {
+            throw std::runtime_error("could not map " + path);
+        }
+    }
+
+    ~MappedFile() { ::munmap(m_data, m_size); }
+
+    MappedFile(const MappedFile&)            = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return static_cast<const char*>(m_data); }
+    size_t size() const { return m_size; }
+
+  private:
+    void* m_data  = nullptr;
+    size_t m_size = 0;
+};
+#endif
+
+// Subtree sizes of every directory in tree, by index, computed on workers
+// threads. Each leaf starts a walk up towards the root; a directory's size is
+// complete once all its subdirectories have reported in, and whichever thread
+// brings in the last one carries on up with it, so every directory is
+// finished exactly once without any thread waiting. Trees with fewer than
+// cutoff directories are done with a single backwards sweep instead.
+std::vector<size_t> subtree_sizes_parallel(const FlatFileTree& tree, size_t workers, size_t cutoff = 1 << 16)
+{
+    const auto& nodes = tree.nodes();
+    const auto count  = nodes.size();
+
+    std::vector<size_t> result(count);
+    if (workers <= 1 || count < cutoff)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            result[i] = nodes[i].files_size;
+        }
+        for (size_t i = count - 1; i > 0; --i)
+        {
+            result[nodes[i].parent] += result[i];
+        }
+        return result;
+    }
+
+    constexpr size_t CHUNK = 4096;
+
+    std::vector<std::atomic<size_t>> sizes(count);
+    std::vector<std::atomic<uint32_t>> pending(count);
+    advent::parallel_ranges(count, workers,
+                            [&](size_t begin, size_t end)
+                            {
+                                for (size_t i = begin; i < end; ++i)
+                                {
+                                    sizes[i].store(nodes[i].files_size, std::memory_order_relaxed);
+                                    pending[i].store(0, std::memory_order_relaxed);
+                                }
+                            },
+                            CHUNK);
+
+    advent::parallel_ranges(count, workers,
+                            [&](size_t begin, size_t end)
+                            {
+                                for (size_t i = std::max<size_t>(begin, 1); i < end; ++i)
+                                {
+                                    pending[nodes[i].parent].fetch_add(1, std::memory_order_relaxed);
+                                }
+                            },
+                            CHUNK);
+
+    advent::parallel_ranges(count, workers,
+                            [&](size_t begin, size_t end)
+                            {
+                                for (size_t i = begin; i < end; ++i)
+                                {
+                                    if (nodes[i].first_child != FlatFileTree::NONE)
+                                    {
+                                        continue;
+                                    }
+
+                                    // i is complete; report to its parent, and keep going up
+                                    // for as long as this was the last one it was waiting on
+                                    for (size_t node = i; node != 0;)
+                                    {
+                                        const size_t size   = sizes[node].load(std::memory_order_acquire);
+                                        result[node]        = size;
+                                        const size_t parent = nodes[node].parent;
+
+                                        sizes[parent].fetch_add(size, std::memory_order_relaxed);
+                                        if (pending[parent].fetch_sub(1, std::memory_order_acq_rel) != 1)
+                                        {
+                                            break;
+                                        }
+                                        node = parent;
+                                    }
+                                }
+                            },
+                            CHUNK);
+
+    result[0] = sizes[0].load();
+    return result;
+}
+
+// Both day 7 answers for a tree
+struct TreeSummary
+{
+    size_t used;
+    size_t small_total;
+    size_t smallest_to_free;
+};
+
+TreeSummary summarize_parallel(const FlatFileTree& tree, size_t workers, size_t cutoff = 1 << 16)
+{
+    const auto sizes = subtree_sizes_parallel(tree, workers, cutoff);
+
+    TreeSummary result {sizes[0], 0, 70000000};
+    const size_t required_space = 30000000 - (70000000 - result.used);
+
+    std::mutex result_mutex;
+    advent::parallel_ranges(sizes.size(), workers < 2 || sizes.size() < cutoff ? 1 : workers,
+                            [&](size_t begin, size_t end)
+                            {
+                                size_t small_total      = 0;
+                                size_t smallest_to_free = 70000000;
+                                for (size_t i = begin; i < end; ++i)
+                                {
+                                    if (sizes[i] <= 100000)
+                                    {
+                                        small_total += sizes[i];
+                                    }
+                                    if (sizes[i] >= required_space)
+                                    {
+                                        smallest_to_free = std::min(smallest_to_free, sizes[i]);
+                                    }
+                                }
+
+                                std::lock_guard<std::mutex> lock(result_mutex);
+                                result.small_total += small_total;
+                                result.smallest_to_free = std::min(result.smallest_to_free, smallest_to_free);
+                            },
+                            1 << 16);
+
+    return result;
+}
+
+// Transcript exploring a random tree of the given number of directories, each
+// holding one file; used for benchmarks
+std::vector<Command> random_commands(size_t directories, unsigned seed)
+{
+    std::mt19937 gen(seed);
+
+    std::vector<Command> result;
+    std::vector<size_t> depth_children {0};
+    for (size_t i = 1; i < directories; ++i)
+    {
+        // Go back up a random amount, but never above the root
+        const auto up = std::uniform_int_distribution<size_t>(0, depth_children.size() - 1)(gen) / 2;
+        for (size_t j = 0; j < up; ++j)
+        {
+            result.push_back(Command {Command::Type::CD, "..", {}});
+            depth_children.pop_back();
+        }
+
+        result.push_back(Command {Command::Type::CD, "d" + std::to_string(depth_children.back()++), {}});
+        result.push_back(Command {Command::Type::LS, "", {File {File::Type::FILE, "f", i % 1000}}});
+        depth_children.push_back(0);
+    }
+    return result;
+}
+
+// Directory sizes sorted once, with prefix sums, to answer any number of size
+// queries about the same filesystem in O(log n) each. Directories are
+// identified by their position in the sizes the index was built from (e.g. a
+// FlatFileTree node index).
+class SizeIndex
+{
+  public:
+    static constexpr size_t NONE = static_cast<size_t>(-1);
+
+    explicit SizeIndex(const std::vector<size_t>& sizes) : m_order(sizes.size()), m_sizes(sizes.size()), m_sums(sizes.size() + 1, 0)
+    {
+        std::iota(m_order.begin(), m_order.end(), size_t(0));
+        std::sort(m_order.begin(), m_order.end(), [&](size_t l, size_t r) { return sizes[l] < sizes[r]; });
+
+        for (size_t i = 0; i < m_order.size(); ++i)
+        {
+            m_sizes[i]    = sizes[m_order[i]];
+            m_sums[i + 1] = m_sums[i] + m_sizes[i];
+        }
+    }
+
+    // Total size of all directories no bigger than threshold
+    size_t sum_at_most(size_t threshold) const
+    {
+        return m_sums[std::upper_bound(m_sizes.begin(), m_sizes.end(), threshold) - m_sizes.begin()];
+    }
+
+    // Size of the smallest directory at least threshold big; NONE if there isn't one
+    size_t smallest_at_least(size_t threshold) const
+    {
+        const auto it = std::lower_bound(m_sizes.begin(), m_sizes.end(), threshold);
+        return it == m_sizes.end() ? NONE : *it;
+    }
+
+    // The k largest directories, largest first
+    std::vector<size_t> largest(size_t k) const
+    {
+        k = std::min(k, m_order.size());
+        return std::vector<size_t>(m_order.rbegin(), m_order.rbegin() + k);
+    }
+
+  private:
+    // Directories sorted by size, their sizes, and the running totals of those
+    std::vector<size_t> m_order;
+    std::vector<size_t> m_sizes;
+    std::vector<size_t> m_sums;
+};
+
+constexpr size_t SizeIndex::NONE;
+
+// Computes directory sizes straight from the transcript, a line at a time,
+// without building a tree; only the sizes of the directories on the current
+// path are kept. A directory's size is final once it is left (by `cd ..`,
+// `cd /` or the end of the transcript), and is passed to on_directory then.
+// Listing the current directory again is ignored, as it is when building a
+// tree.
+//
+// This only works for a depth-first walk, where a directory is entered once:
+// if one is entered again, its size has already been reported, so streaming
+// stops and REENTERED is returned. Otherwise returns the size of the root,
+// which is also the last one reported.
+constexpr size_t REENTERED = static_cast<size_t>(-1);
+
+template <class F> size_t stream_directory_sizes(std::istream& in, const F& on_directory)
+{
+    std::vector<size_t> path {0};
+
+    // Whether each directory on the path has been listed, and whether the
+    // files being read are from a repeat listing
+    std::vector<bool> listed {false};
+    bool repeat_listing = false;
+
+    // The names of the subdirectories each directory on the path has entered
+    std::vector<std::unordered_set<std::string>> entered(1);
+
+    const auto leave = [&]
+    {
+        const auto size = path.back();
+        path.pop_back();
+        listed.pop_back();
+        entered.pop_back();
+        path.back() += size;
+        on_directory(size);
+    };
+
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.empty() || line.compare(0, 4, "dir ") == 0)
+        {
+            continue;
+        }
+
+        if (line == "$ ls")
+        {
+            repeat_listing = listed.back();
+            listed.back()  = true;
+            continue;
+        }
+
+        if (line.compare(0, 5, "$ cd ") != 0)
+        {
+            if (!repeat_listing)
+            {
+                path.back() += std::stoull(line);
+            }
+            continue;
+        }
+
+        repeat_listing = false;
+        if (line.compare(5, std::string::npos, "..") == 0)
+        {
+            if (path.size() > 1)
+            {
+                leave();
+            }
+        }
+        else if (line.compare(5, std::string::npos, "/") == 0)
+        {
+            while (path.size() > 1)
+            {
+                leave();
+            }
+        }
+        else
+        {
+            if (!entered.back().insert(line.substr(5)).second)
+            {
+                return REENTERED;
+            }
+
+            path.push_back(0);
+            listed.push_back(false);
+            entered.emplace_back();
+        }
+    }
+
+    while (path.size() > 1)
+    {
+        leave();
+    }
+    on_directory(path.back());
+
+    return path.back();
+}
+
+void write_transcript(std::ostream& out, const std::vector<Command>& commands)
+{
+    for (const auto& c : commands)
+    {
+        if (c.type == Command::Type::CD)
+        {
+            out << "$ cd " << c.cd_arg << "\n";
+            continue;
+        }
+
+        out << "$ ls\n";
+        for (const auto& f : c.ls_files)
+        {
+            if (f.type == File::Type::DIR)
+            {
+                out << "dir " << f.name << "\n";
+            }
+            else
+            {
+                out << f.size << " " << f.name << "\n";
+            }
+        }
+    }
+}
+
+TEST(Day7, Tokenize)
+{
+    Tokenizer tokens("$ cd ..\n$ ls\n\ndir a b\r\n1234 file.txt\n5678 other_file");
+
+    std::vector<std::tuple<Token::Type, std::string_view, size_t>> result;
+    Token t;
+    while (tokens.next(t))
+    {
+        result.emplace_back(t.type, t.name, t.size);
+    }
+
+    EXPECT_EQ(result, (std::vector<std::tuple<Token::Type, std::string_view, size_t>>({{Token::Type::CD, "..", 0},
+                                                                                      {Token::Type::LS, "", 0},
+                                                                                      {Token::Type::DIR, "a b", 0},
+                                                                                      {Token::Type::FILE, "file.txt", 1234},
+                                                                                      {Token::Type::FILE, "other_file", 5678}})));
+}
+
+TEST(Day7, ReadCommandViews)
+{
+    const std::string text = "$ cd /\n$ ls\n$ ls\ndir a\n10 b\n$ cd a\n$ ls\n20 c\n";
+
+    CommandReader reader(text);
+    CommandView c;
+
+    ASSERT_TRUE(reader.next(c));
+    EXPECT_EQ(c.type, Command::Type::CD);
+    EXPECT_EQ(c.cd_arg, "/");
+
+    ASSERT_TRUE(reader.next(c));
+    EXPECT_EQ(c.type, Command::Type::LS);
+    EXPECT_EQ(c.listing, "");
+
+    ASSERT_TRUE(reader.next(c));
+    EXPECT_EQ(c.type, Command::Type::LS);
+    EXPECT_EQ(c.listing, "dir a\n10 b");
+
+    ASSERT_TRUE(reader.next(c));
+    EXPECT_EQ(c.cd_arg, "a");
+
+    ASSERT_TRUE(reader.next(c));
+    EXPECT_EQ(c.listing, "20 c\n");
+
+    EXPECT_FALSE(reader.next(c));
+}
+
+TEST(Day7, ParseInput)
+{
+    const static char* INPUT_DATA = R"in($ cd /
+$ cd abc
+$ ls
+dir a
+dir b
+1234 file.txt
+5678 other_file
+$ cd /)in";
+
+    std::stringstream ss_in;
+    ss_in << INPUT_DATA;
+
+    const auto commands = read_input(ss_in);
+
+    ASSERT_EQ(commands.size(), 4U);
+    EXPECT_EQ(commands[0], Command({Command::Type::CD, "/", {}}));
+    EXPECT_EQ(commands[1], Command({Command::Type::CD, "abc", {}}));
+    EXPECT_EQ(commands[2], Command({Command::Type::LS,
+                                    "",
+                                    {File({File::Type::DIR, "a", 0}), File({File::Type::DIR, "b", 0}),
+                                     File({File::Type::FILE, "file.txt", 1234}), File({File::Type::FILE, "other_file", 5678})}}));
+    EXPECT_EQ(commands[3], Command({Command::Type::CD, "/", {}}));
+}
+
+TEST(Day7, BuildTreeSimple)
+{
+    std::vector<Command> commands {Command {Command::Type::LS, "", {File {File::Type::FILE, "a", 10}, File {File::Type::FILE, "b", 20}}}};
+    auto tree = build_tree(commands);
+
+    EXPECT_EQ(tree->children().size(), 0);
+    EXPECT_EQ(tree->size(), 30);
+}
+
+TEST(Day7, BuildTreeNested)
+{
+    std::vector<Command> commands {
+        Command {
+            Command::Type::LS, "", {File {File::Type::DIR, "x", 0}, File {File::Type::FILE, "a", 10}, File {File::Type::FILE, "b", 20}}},
+        Command {Command::Type::CD, "x", {}}, Command {Command::Type::LS, "", {File {File::Type::FILE, "a", 30}}}};
+
+    auto tree = build_tree(commands);
+
+    ASSERT_EQ(tree->children().size(), 1);
+    EXPECT_EQ(tree->children()[0], "x");
+    EXPECT_EQ(tree->size(), 60);
+
+    auto sub_tree = tree->child("x");
+    EXPECT_EQ(sub_tree->children().size(), 0);
+    EXPECT_EQ(sub_tree->size(), 30);
+}
+
+TEST(Day7, FlatTreeMatchesTree)
+{
+    const auto commands = random_commands(2000, 7);
+
+    const auto tree      = build_tree(commands);
+    const auto flat_tree = build_flat_tree(commands);
+
+    std::vector<size_t> sizes;
+    visit(*tree, [&](const FileTree& ft) { sizes.push_back(ft.size()); });
+
+    std::vector<size_t> flat_sizes;
+    for (const auto& node : flat_tree.nodes())
+    {
+        flat_sizes.push_back(node.size);
+    }
+
+    std::sort(sizes.begin(), sizes.end());
+    std::sort(flat_sizes.begin(), flat_sizes.end());
+    EXPECT_EQ(flat_sizes, sizes);
+
+    const auto d0 = flat_tree.find_child(flat_tree.root(), "d0");
+    ASSERT_NE(d0, FlatFileTree::NONE);
+    EXPECT_EQ(flat_tree.name(d0), "d0");
+    EXPECT_EQ(flat_tree.size(d0), tree->child("d0")->size());
+    EXPECT_EQ(flat_tree.find_child(flat_tree.root(), "missing"), FlatFileTree::NONE);
+}
+
+TEST(Day7, SizeAfterEdits)
+{
+    FileTree root("/");
+    auto* a = root.child("a");
+    auto* b = a->child("b");
+
+    b->add_file("x", 10);
+    EXPECT_EQ(root.size(), 10);
+    EXPECT_EQ(a->size(), 10);
+
+    // Ancestors that were already queried see later changes further down
+    b->add_file("y", 5);
+    root.child("c")->add_file("x", 1);
+    a->add_file("x", 100);
+    b->add_file("x", 10);
+
+    EXPECT_EQ(b->size(), 15);
+    EXPECT_EQ(a->size(), 115);
+    EXPECT_EQ(root.size(), 116);
+}
+
+TEST(Day7, DirectorySizes)
+{
+    std::vector<Command> commands {
+        Command {Command::Type::LS, "", {File {File::Type::FILE, "a", 10}}},  Command {Command::Type::CD, "x", {}},
+        Command {Command::Type::LS, "", {File {File::Type::FILE, "a", 30}}},  Command {Command::Type::CD, "y", {}},
+        Command {Command::Type::LS, "", {File {File::Type::FILE, "a", 5}}},   Command {Command::Type::CD, "/", {}},
+        Command {Command::Type::CD, "z", {}}, Command {Command::Type::LS, "", {File {File::Type::FILE, "a", 1}}}};
+
+    const auto tree = build_tree(commands);
+    EXPECT_EQ(directory_sizes(*tree), std::vector<size_t>({5, 35, 1, 46}));
+
+    std::vector<std::string> names;
+    visit(*tree, [&](const FileTree& ft) { names.push_back(ft.name()); });
+    EXPECT_EQ(names, std::vector<std::string>({"/", "x", "y", "z"}));
+}
+
+TEST(Day7, DeepTree)
+{
+    // Deep enough to overflow the stack if walked recursively
+    std::vector<Command> commands;
+    for (size_t i = 0; i < 200000; ++i)
+    {
+        commands.push_back(Command {Command::Type::CD, "d", {}});
+    }
+    commands.push_back(Command {Command::Type::LS, "", {File {File::Type::FILE, "f", 1}}});
+
+    const auto tree = build_tree(commands);
+    EXPECT_EQ(tree->size(), 1);
+
+    size_t count = 0;
+    visit(*tree, [&](const FileTree&) { ++count; });
+    EXPECT_EQ(count, 200001);
+    EXPECT_EQ(directory_sizes(*tree), std::vector<size_t>(200001, 1));
+}
+
+TEST(Day7, SizeIndex)
+{
+    const SizeIndex index({30, 10, 50, 20, 10});
+
+    EXPECT_EQ(index.sum_at_most(0), 0);
+    EXPECT_EQ(index.sum_at_most(10), 20);
+    EXPECT_EQ(index.sum_at_most(25), 40);
+    EXPECT_EQ(index.sum_at_most(1000), 120);
+
+    EXPECT_EQ(index.smallest_at_least(0), 10);
+    EXPECT_EQ(index.smallest_at_least(11), 20);
+    EXPECT_EQ(index.smallest_at_least(50), 50);
+    EXPECT_EQ(index.smallest_at_least(51), SizeIndex::NONE);
+
+    EXPECT_EQ(index.largest(2), std::vector<size_t>({2, 0}));
+    EXPECT_EQ(index.largest(10).size(), 5);
+}
+
+TEST(Day7, FlatTreeFromText)
+{
+    const auto commands = random_commands(1000, 5);
+
+    std::stringstream ss;
+    write_transcript(ss, commands);
+
+    const auto from_text     = build_flat_tree(ss.str());
+    const auto from_commands = build_flat_tree(commands);
+
+    ASSERT_EQ(from_text.nodes().size(), from_commands.nodes().size());
+    for (FlatFileTree::Index i = 0; i < from_text.nodes().size(); ++i)
+    {
+        EXPECT_EQ(from_text.name(i), from_commands.name(i));
+        EXPECT_EQ(from_text.size(i), from_commands.size(i));
+    }
+}
+
+TEST(Day7, ParallelMatchesVisit)
+{
+    std::stringstream ss;
+    write_transcript(ss, random_commands(20000, 17));
+
+    // A chain deep enough that most of it is finished by whichever thread
+    // brings in the last leaf
+    for (size_t i = 0; i < 5000; ++i)
+    {
+        ss << "$ cd chain\n$ ls\n1 f\n";
+    }
+
+    const auto text      = ss.str();
+    const auto flat_tree = build_flat_tree(text);
+
+    std::stringstream ss_in(text);
+    const auto tree = build_tree(read_input(ss_in));
+
+    TreeSummary expected {tree->size(), 0, 70000000};
+    const size_t required_space = 30000000 - (70000000 - expected.used);
+    visit(*tree,
+          [&](const FileTree& ft)
+          {
+              if (ft.size() <= 100000)
+              {
+                  expected.small_total += ft.size();
+              }
+              if (ft.size() >= required_space)
+              {
+                  expected.smallest_to_free = std::min(expected.smallest_to_free, ft.size());
+              }
+          });
+
+    std::vector<size_t> expected_sizes;
+    for (const auto& node : flat_tree.nodes())
+    {
+        expected_sizes.push_back(node.size);
+    }
+
+    for (const size_t workers : {1, 2, 4})
+    {
+        EXPECT_EQ(subtree_sizes_parallel(flat_tree, workers, 0), expected_sizes) << workers;
+
+        const auto summary = summarize_parallel(flat_tree, workers, 0);
+        EXPECT_EQ(summary.used, expected.used);
+        EXPECT_EQ(summary.small_total, expected.small_total);
+        EXPECT_EQ(summary.smallest_to_free, expected.smallest_to_free);
+    }
+}
+
+TEST(Day7, Snapshot)
+{
+    const auto flat_tree = build_flat_tree(random_commands(500, 3));
+
+    std::stringstream ss;
+    write_snapshot(ss, flat_tree);
+    const auto buffer = ss.str();
+
+    const TreeSnapshot snapshot(buffer.data(), buffer.size());
+    ASSERT_EQ(snapshot.node_count(), flat_tree.nodes().size());
+    for (FlatFileTree::Index i = 0; i < snapshot.node_count(); ++i)
+    {
+        EXPECT_EQ(snapshot.size(i), flat_tree.size(i));
+        EXPECT_EQ(snapshot.name(i), flat_tree.name(i));
+        EXPECT_EQ(snapshot.parent(i), flat_tree.parent(i));
+    }
+
+    const auto d0 = snapshot.find_child(snapshot.root(), "d0");
+    EXPECT_EQ(d0, flat_tree.find_child(flat_tree.root(), "d0"));
+    EXPECT_EQ(snapshot.find_child(d0, "missing"), FlatFileTree::NONE);
+
+    EXPECT_THROW(TreeSnapshot(buffer.data(), buffer.size() - 1), std::runtime_error);
+    EXPECT_THROW(TreeSnapshot(buffer.data() + 1, buffer.size() - 1), std::runtime_error);
+
+    // Corrupt links: a name past the end of the names, and a sibling cycle
+    const auto corrupt = [&](size_t node, size_t field, uint32_t value)
+    {
+        auto copy = buffer;
+        std::memcpy(&copy[sizeof(SnapshotHeader) + node * sizeof(SnapshotNode) + field], &value, sizeof(value));
+        return copy;
+    };
+    const auto past_names = corrupt(1, offsetof(SnapshotNode, name_offset), UINT32_MAX);
+    const auto cycle      = corrupt(1, offsetof(SnapshotNode, next_sibling), 1);
+    EXPECT_THROW(TreeSnapshot(past_names.data(), past_names.size()), std::runtime_error);
+    EXPECT_THROW(TreeSnapshot(cycle.data(), cycle.size()), std::runtime_error);
+
+#ifdef __unix__
+    const auto path = testing::TempDir() + "day_7_snapshot.bin";
+    {
+        std::ofstream file(path, std::ios::binary);
+        write_snapshot(file, flat_tree);
+    }
+
+    const MappedFile mapped(path);
+    const TreeSnapshot mapped_snapshot(mapped.data(), mapped.size());
+
+    size_t total = 0;
+    mapped_snapshot.for_each_size([&](size_t size) { total += size; });
+
+    size_t expected_total = 0;
+    for (const auto& node : flat_tree.nodes())
+    {
+        expected_total += node.size;
+    }
+    EXPECT_EQ(total, expected_total);
+
+    std::remove(path.c_str());
+#endif
+}
+
+TEST(Day7, StreamMatchesTree)
+{
+    const auto commands = random_commands(2000, 11);
+    const auto tree     = build_tree(commands);
+
+    std::stringstream ss_in;
+    write_transcript(ss_in, commands);
+
+    std::vector<size_t> sizes;
+    visit(*tree, [&](const FileTree& ft) { sizes.push_back(ft.size()); });
+
+    std::vector<size_t> stream_sizes;
+    EXPECT_EQ(stream_directory_sizes(ss_in, [&](size_t size) { stream_sizes.push_back(size); }), tree->size());
+
+    std::sort(sizes.begin(), sizes.end());
+    std::sort(stream_sizes.begin(), stream_sizes.end());
+    EXPECT_EQ(stream_sizes, sizes);
+
+    // Listing a directory again does not count its files twice
+    std::stringstream relisted("$ cd /\n$ ls\n100 a\ndir d\n$ cd d\n$ ls\n5 b\n$ ls\n5 b\n$ cd ..\n$ ls\n100 a\ndir d\n");
+    stream_sizes.clear();
+    EXPECT_EQ(stream_directory_sizes(relisted, [&](size_t size) { stream_sizes.push_back(size); }), 105u);
+    EXPECT_EQ(stream_sizes, std::vector<size_t>({5, 105}));
+}
+
+// Not run by default; use --gtest_also_run_disabled_tests
+TEST(Day7, DISABLED_BenchmarkFlatTree)
+{
+    const auto commands = random_commands(2000000, 42);
+
+    auto start = std::chrono::steady_clock::now();
+
+    const auto tree = build_tree(commands);
+    size_t total    = 0;
+    visit(*tree, [&](const FileTree& ft) { total += ft.size(); });
+
+    const std::chrono::duration<double> tree_time = std::chrono::steady_clock::now() - start;
+    start                                         = std::chrono::steady_clock::now();
+
+    const auto flat_tree = build_flat_tree(commands);
+    size_t flat_total    = 0;
+    for (const auto& node : flat_tree.nodes())
+    {
+        flat_total += node.size;
+    }
+
+    const std::chrono::duration<double> flat_time = std::chrono::steady_clock::now() - start;
+
+    EXPECT_EQ(flat_total, total);
+    std::cout << "FileTree: " << tree_time.count() << "s, FlatFileTree: " << flat_time.count() << "s" << std::endl;
+}
+}
+
+void day_7(std::istream& input, std::ostream& output)
+{
+    using namespace day_7_impl;
+
+    // Stream the transcript if it can be read again, as the tree is needed
+    // instead if a directory is entered twice; a pipe is buffered first
+    std::stringstream buffered;
+    std::istream* in = &input;
+    if (input.tellg() == std::streampos(-1))
+    {
+        buffered << input.rdbuf();
+        in = &buffered;
+    }
+    const auto start = in->tellg();
+
+    size_t sum_size      = 0;
+    const auto add_small = [&](size_t size)
+    {
+        if (size <= 100000)
+        {
+            sum_size += size;
+        }
+    };
+
+    if (stream_directory_sizes(*in, add_small) == REENTERED)
+    {
+        in->clear();
+        in->seekg(start);
+        const std::string transcript {std::istreambuf_iterator<char>(*in), std::istreambuf_iterator<char>()};
+
+        sum_size = 0;
+        for (const auto& node : build_flat_tree(transcript).nodes())
+        {
+            add_small(node.size);
+        }
+    }
+
+    output << sum_size;
+}
+
+void day_7_adv(std::istream& input, std::ostream& output)
+{
+    using namespace day_7_impl;
+
+    // How much has to be freed is only known once the root is done, so every
+    // size is needed anyway; the tree costs no more, and allows any walk
+    const std::string transcript {std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>()};
+    const auto tree = build_flat_tree(transcript);
+
+    std::vector<size_t> sizes;
+    for (const auto& node : tree.nodes())
+    {
+        sizes.push_back(node.size);
+    }
+    const size_t used = tree.size(tree.root());
+
+    size_t required_space = 30000000 - (70000000 - used);
+
+    // As before the index, report the disk size if no directory is big enough
+    const auto smallest_match = SizeIndex(sizes).smallest_at_least(required_space);
+    output << (smallest_match == SizeIndex::NONE ? 70000000 : smallest_match);
+}
+
+TEST(Day7, ReenteredDirectory)
+{
+    using namespace day_7_impl;
+
+    const std::string transcript = "$ cd /\n$ ls\ndir a\n$ cd a\n$ ls\n10 x\n$ cd ..\n$ cd a\n$ ls\n10 x\n";
+
+    std::stringstream stream_in(transcript);
+    EXPECT_EQ(stream_directory_sizes(stream_in, [](size_t) {}), REENTERED);
+
+    std::stringstream ss_in(transcript), ss_out;
+    day_7(ss_in, ss_out);
+    EXPECT_EQ(ss_out.str(), "20");
+
+    // Too little is used for anything to be big enough, so the disk size
+    std::stringstream adv_in(transcript), adv_out;
+    day_7_adv(adv_in, adv_out);
+    EXPECT_EQ(adv_out.str(), "70000000");
+}
+
+TEST(Day7, NothingBigEnough)
+{
+    // Little enough is used that the required space wraps around, so no
+    // directory is big enough
+    std::stringstream ss_in("$ cd /\n$ ls\n100 a\n"), ss_out;
+    day_7_adv(ss_in, ss_out);
 
-    output << smallest_match;
+    EXPECT_EQ(ss_out.str(), "70000000");
 }
 
 TEST(Day7, Example)
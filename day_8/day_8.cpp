@@ -1,8 +1,28 @@
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
 #include <iostream>
+#include <iterator>
+#include <mutex>
 #include <numeric>
+#include <random>
+#include <sstream>
+#include <stdexcept>
 
 #include <gtest/gtest.h>
 
+#include "cpu.h"
+#include "parallel.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define DAY_8_AVX2 1
+#include <immintrin.h>
+#endif
+
 namespace day_8_impl
 {
 template <class T> class ColumnIterator
@@ -67,8 +87,17 @@ Forest read_input(std::istream& in)
     Forest result;
 
     std::string line;
-    while (std::getline(in, line) && !line.empty())
+    while (std::getline(in, line))
     {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+        if (line.empty())
+        {
+            break;
+        }
+
         std::vector<Tree> tree_line;
         tree_line.reserve(line.size());
 
@@ -84,7 +113,7 @@ Forest read_input(std::istream& in)
         {
             for (const auto& row : result)
             {
-                if (row.size() != result.size())
+                if (row.size() != result.front().size())
                     return false;
             }
             return true;
@@ -128,7 +157,7 @@ void mark_visible_trees(Forest& f)
         mark_visible_trees(row.begin(), row.end());
     }
 
-    for (size_t i = 0; i < f.size(); ++i)
+    for (size_t i = 0; !f.empty() && i < f.front().size(); ++i)
     {
         mark_visible_trees(begin_column(f, i), end_column(f, i));
     }
@@ -143,9 +172,12 @@ size_t count_visible_trees(const Forest& f)
 
 size_t scenic_score(const Forest& f, size_t y, size_t x)
 {
+    const size_t height = f.size();
+    const size_t width  = f[y].size();
+
     // score 0 on the border - important to shortcut so checks below don't
     // go out of bounds
-    if (x == 0 || y == 0 || x == f.size() - 1 || y == f.size() - 1)
+    if (x == 0 || y == 0 || x == width - 1 || y == height - 1)
     {
         return 0;
     }
@@ -157,47 +189,938 @@ size_t scenic_score(const Forest& f, size_t y, size_t x)
 
     size_t this_height = f[y][x].first;
 
-    for (size_t i = x + 1; i < f.size() - 1 && f[y][i].first < this_height; ++i, ++score_right)
+    for (size_t i = x + 1; i < width - 1 && f[y][i].first < this_height; ++i, ++score_right)
         ;
 
     for (size_t i = 1; i < x && f[y][x - i].first < this_height; ++i, ++score_left)
         ;
 
-    for (size_t i = y + 1; i < f.size() - 1 && f[i][x].first < this_height; ++i, ++score_down)
+    for (size_t i = y + 1; i < height - 1 && f[i][x].first < this_height; ++i, ++score_down)
         ;
 
     for (size_t i = 1; i < y && f[y - i][x].first < this_height; ++i, ++score_up)
         ;
     return score_left * score_right * score_up * score_down;
 }
+
+// One sweep along a line of trees, looking back towards the start of the line.
+// tree(i) and score(i) are the i-th tree of the line and its score. Each tree
+// is marked visible if nothing before it is as tall, and its viewing distance
+// back along the line is multiplied into its score.
+//
+// blockers holds the trees that could still block a later one, as (height,
+// position); a tree hides any earlier ones no taller than it, so heights
+// strictly decrease down the stack and each tree is pushed and popped once.
+template <class TreeF, class ScoreF>
+void sweep_line(size_t length, const TreeF& tree, const ScoreF& score, std::vector<std::pair<size_t, size_t>>& blockers)
+{
+    blockers.clear();
+    for (size_t i = 0; i < length; ++i)
+    {
+        Tree& t = tree(i);
+        while (!blockers.empty() && blockers.back().first < t.first)
+        {
+            blockers.pop_back();
+        }
+
+        if (blockers.empty())
+        {
+            t.second = true;
+            score(i) *= i;
+        }
+        else
+        {
+            score(i) *= i - blockers.back().second;
+            if (blockers.back().first == t.first)
+            {
+                blockers.pop_back();
+            }
+        }
+        blockers.emplace_back(t.first, i);
+    }
 }
 
-void day_8(std::istream& in, std::ostream& out)
+// Marks every visible tree (like mark_visible_trees) and returns the scenic
+// score of every tree, from one sweep in each direction along every row and
+// column
+std::vector<std::vector<size_t>> scenic_scores(Forest& f)
 {
-    using namespace day_8_impl;
+    const size_t height = f.size();
+    const size_t width  = height ? f[0].size() : 0;
+
+    std::vector<std::vector<size_t>> scores(height, std::vector<size_t>(width, 1));
+    std::vector<std::pair<size_t, size_t>> blockers;
 
-    auto forest = read_input(in);
-    mark_visible_trees(forest);
+    for (size_t y = 0; y < height; ++y)
+    {
+        sweep_line(
+            width, [&](size_t x) -> Tree& { return f[y][x]; }, [&](size_t x) -> size_t& { return scores[y][x]; }, blockers);
+        sweep_line(
+            width, [&](size_t x) -> Tree& { return f[y][width - 1 - x]; },
+            [&](size_t x) -> size_t& { return scores[y][width - 1 - x]; }, blockers);
+    }
 
-    out << count_visible_trees(forest);
+    for (size_t x = 0; x < width; ++x)
+    {
+        sweep_line(
+            height, [&](size_t y) -> Tree& { return f[y][x]; }, [&](size_t y) -> size_t& { return scores[y][x]; }, blockers);
+        sweep_line(
+            height, [&](size_t y) -> Tree& { return f[height - 1 - y][x]; },
+            [&](size_t y) -> size_t& { return scores[height - 1 - y][x]; }, blockers);
+    }
+
+    return scores;
 }
 
-void day_8_adv(std::istream& in, std::ostream& out)
+// A forest stored as one byte of height per tree, in row-major order, with
+// visibility kept separately as one bit per tree. Each row of visibility bits
+// starts on a new word, so different rows can be written independently.
+class FlatForest
 {
-    using namespace day_8_impl;
+  public:
+    // A line of trees through the grid; consecutive trees are stride apart
+    template <class T> struct Line
+    {
+        T* data;
+        size_t stride;
+        size_t size;
+
+        T& operator[](size_t i) const { return data[i * stride]; }
+    };
+
+    FlatForest() = default;
+    FlatForest(size_t width, std::vector<uint8_t> heights)
+        : m_width(width), m_height(width ? heights.size() / width : 0), m_words_per_row((width + 63) / 64), m_heights(std::move(heights)),
+          m_visible(m_height * m_words_per_row, 0)
+    {
+        assert(m_width * m_height == m_heights.size());
+    }
+
+    size_t width() const { return m_width; }
+    size_t height() const { return m_height; }
+
+    uint8_t at(size_t y, size_t x) const { return m_heights[y * m_width + x]; }
+    const uint8_t* data() const { return m_heights.data(); }
+
+    Line<const uint8_t> row(size_t y) const { return {m_heights.data() + y * m_width, 1, m_width}; }
+    Line<const uint8_t> column(size_t x) const { return {m_heights.data() + x, m_width, m_height}; }
+
+    bool visible(size_t y, size_t x) const { return (m_visible[y * m_words_per_row + x / 64] >> (x % 64)) & 1; }
+    void set_visible(size_t y, size_t x) { m_visible[y * m_words_per_row + x / 64] |= uint64_t(1) << (x % 64); }
+
+    // Visibility bits of row y
+    uint64_t* visible_row(size_t y) { return m_visible.data() + y * m_words_per_row; }
+
+    size_t count_visible() const
+    {
+        return std::accumulate(m_visible.begin(), m_visible.end(), size_t(0),
+                               [](size_t total, uint64_t word) { return total + std::bitset<64>(word).count(); });
+    }
+
+  private:
+    size_t m_width         = 0;
+    size_t m_height        = 0;
+    size_t m_words_per_row = 0;
+
+    std::vector<uint8_t> m_heights;
+    std::vector<uint64_t> m_visible;
+};
+
+// Bytes left to read in the stream, or 0 if it cannot tell (e.g. a pipe)
+size_t remaining_bytes(std::istream& in)
+{
+    const auto start = in.tellg();
+    if (start == std::istream::pos_type(-1) || !in.seekg(0, std::ios::end))
+    {
+        in.clear();
+        return 0;
+    }
+
+    const auto end = in.tellg();
+    in.seekg(start);
+    return end > start ? static_cast<size_t>(end - start) : 0;
+}
+
+// Reads the grid a block at a time, converting digits straight into the flat
+// height buffer, which is sized up front from the length of the stream when
+// that is known. Rows may be any width, but all the same one, and may have
+// trailing whitespace; the grid ends at an empty line or the end of the
+// stream. Anything else that is not a digit is an error, as the sweeps index
+// by height.
+FlatForest read_flat_input(std::istream& in, size_t block_size = 1 << 16)
+{
+    std::vector<uint8_t> heights;
+    heights.reserve(remaining_bytes(in));
+
+    std::vector<char> block(block_size);
+
+    size_t width     = 0;
+    size_t row_start = 0;
+    bool done        = false;
+
+    const auto is_space = [](uint8_t h)
+    { return h == static_cast<uint8_t>(' ' - '0') || h == static_cast<uint8_t>('\t' - '0') || h == static_cast<uint8_t>('\r' - '0'); };
+
+    // Closes off the row being read; false once the grid has ended
+    const auto end_row = [&]
+    {
+        while (heights.size() > row_start && is_space(heights.back()))
+        {
+            heights.pop_back();
+        }
+
+        const size_t row_width = heights.size() - row_start;
+        if (row_width == 0)
+        {
+            return false;
+        }
+        if (std::any_of(heights.begin() + static_cast<std::ptrdiff_t>(row_start), heights.end(), [](uint8_t h) { return h > 9; }))
+        {
+            throw std::runtime_error("Forest rows must only hold digits");
+        }
+        if (width == 0)
+        {
+            width = row_width;
+        }
+        else if (row_width != width)
+        {
+            throw std::runtime_error("Forest rows are not all the same width");
+        }
+        row_start = heights.size();
+        return true;
+    };
+
+    while (!done && in)
+    {
+        in.read(block.data(), static_cast<std::streamsize>(block.size()));
+
+        const char* curr = block.data();
+        const char* end  = curr + in.gcount();
+        while (curr != end)
+        {
+            const char* line_end = std::find(curr, end, '\n');
+            std::transform(curr, line_end, std::back_inserter(heights), [](char c) { return static_cast<uint8_t>(c - '0'); });
+            if (line_end == end)
+            {
+                break;
+            }
+
+            curr = line_end + 1;
+            if (!end_row())
+            {
+                done = true;
+                break;
+            }
+        }
+    }
+
+    if (!done)
+    {
+        end_row();
+    }
+
+    return FlatForest(width, std::move(heights));
+}
+
+// OR bits into the bitset words, starting at bit index first; anything that
+// does not fit in that word spills into the next one
+inline void or_bits(uint64_t* words, size_t first, uint64_t bits)
+{
+    const size_t shift = first % 64;
+    words[first / 64] |= bits << shift;
+    if (shift > 0 && (bits >> (64 - shift)) != 0)
+    {
+        words[first / 64 + 1] |= bits >> (64 - shift);
+    }
+}
+
+// In the sweeps below, trees are compared as height + 1 so that 0 can stand
+// for "nothing seen yet"
+
+// Both directions along one row
+void sweep_row_scalar(const uint8_t* row, size_t width, uint64_t* visible)
+{
+    uint8_t tallest = 0;
+    for (size_t x = 0; x < width && tallest <= 9; ++x)
+    {
+        if (row[x] + 1 > tallest)
+        {
+            tallest = row[x] + 1;
+            or_bits(visible, x, 1);
+        }
+    }
+
+    tallest = 0;
+    for (size_t x = width; x-- > 0 && tallest <= 9;)
+    {
+        if (row[x] + 1 > tallest)
+        {
+            tallest = row[x] + 1;
+            or_bits(visible, x, 1);
+        }
+    }
+}
+
+// One row of the column sweeps: keep the tallest tree so far in each column
+// and mark the trees taller than it
+void sweep_columns_scalar(const uint8_t* row, uint8_t* tallest, size_t width, uint64_t* visible)
+{
+    for (size_t x = 0; x < width; ++x)
+    {
+        if (row[x] + 1 > tallest[x])
+        {
+            tallest[x] = row[x] + 1;
+            or_bits(visible, x, 1);
+        }
+    }
+}
+
+#ifdef DAY_8_AVX2
+// One row of the column sweeps: 32 columns at a time, keep the tallest tree
+// so far in each column and mark the trees taller than it
+__attribute__((target("avx2"))) void sweep_columns_avx2(const uint8_t* row, uint8_t* tallest, size_t width, uint64_t* visible)
+{
+    const __m256i one = _mm256_set1_epi8(1);
+
+    size_t x = 0;
+    for (; x + 32 <= width; x += 32)
+    {
+        const __m256i trees  = _mm256_add_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x)), one);
+        const __m256i before = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tallest + x));
+
+        const auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpgt_epi8(trees, before)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(tallest + x), _mm256_max_epu8(trees, before));
+        or_bits(visible, x, mask);
+    }
+
+    for (; x < width; ++x)
+    {
+        const uint8_t tree = row[x] + 1;
+        if (tree > tallest[x])
+        {
+            tallest[x] = tree;
+            or_bits(visible, x, 1);
+        }
+    }
+}
+
+// Both directions along one row, 16 trees at a time: a running max within the
+// register (by shifting and taking the max 4 times) gives the tallest tree
+// before each one, and the last lane carries on to the next 16
+__attribute__((target("avx2"))) void sweep_row_avx2(const uint8_t* row, size_t width, uint64_t* visible)
+{
+    const __m128i one = _mm_set1_epi8(1);
+
+    __m128i carry = _mm_setzero_si128();
+    size_t x      = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        const __m128i trees = _mm_add_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x)), one);
+
+        __m128i tallest = trees;
+        tallest         = _mm_max_epu8(tallest, _mm_slli_si128(tallest, 1));
+        tallest         = _mm_max_epu8(tallest, _mm_slli_si128(tallest, 2));
+        tallest         = _mm_max_epu8(tallest, _mm_slli_si128(tallest, 4));
+        tallest         = _mm_max_epu8(tallest, _mm_slli_si128(tallest, 8));
+
+        const __m128i before = _mm_max_epu8(_mm_slli_si128(tallest, 1), carry);
+        or_bits(visible, x, static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(trees, before))));
+        carry = _mm_max_epu8(carry, _mm_shuffle_epi8(tallest, _mm_set1_epi8(15)));
+    }
+
+    auto tallest = static_cast<uint8_t>(_mm_cvtsi128_si32(carry));
+    for (; x < width; ++x)
+    {
+        if (row[x] + 1 > tallest)
+        {
+            tallest = row[x] + 1;
+            or_bits(visible, x, 1);
+        }
+    }
+
+    // Right to left is the mirror image, with any trees left over at the left
+    carry = _mm_setzero_si128();
+    x     = width;
+    for (; x >= 16; x -= 16)
+    {
+        const __m128i trees = _mm_add_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x - 16)), one);
+
+        __m128i tallest = trees;
+        tallest         = _mm_max_epu8(tallest, _mm_srli_si128(tallest, 1));
+        tallest         = _mm_max_epu8(tallest, _mm_srli_si128(tallest, 2));
+        tallest         = _mm_max_epu8(tallest, _mm_srli_si128(tallest, 4));
+        tallest         = _mm_max_epu8(tallest, _mm_srli_si128(tallest, 8));
+
+        const __m128i after = _mm_max_epu8(_mm_srli_si128(tallest, 1), carry);
+        or_bits(visible, x - 16, static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(trees, after))));
+        carry = _mm_max_epu8(carry, _mm_shuffle_epi8(tallest, _mm_setzero_si128()));
+    }
+
+    tallest = static_cast<uint8_t>(_mm_cvtsi128_si32(carry));
+    while (x-- > 0)
+    {
+        if (row[x] + 1 > tallest)
+        {
+            tallest = row[x] + 1;
+            or_bits(visible, x, 1);
+        }
+    }
+}
+
+#endif
+
+using RowSweep    = void (*)(const uint8_t* row, size_t width, uint64_t* visible);
+using ColumnSweep = void (*)(const uint8_t* row, uint8_t* tallest, size_t width, uint64_t* visible);
+
+// Row sweeps go along each row in both directions; columns are swept a whole
+// row at a time, keeping the tallest tree so far in every column, so the grid
+// is only ever read in memory order. Rows are split between threads, and then
+// columns, in bands of whole visibility words so no two threads share one.
+void mark_visible_trees(FlatForest& f, RowSweep sweep_row, ColumnSweep sweep_columns, size_t threads)
+{
+    const size_t width  = f.width();
+    const size_t height = f.height();
+
+    advent::parallel_ranges(height, threads,
+                            [&](size_t begin, size_t end)
+                            {
+                                for (size_t y = begin; y < end; ++y)
+                                {
+                                    sweep_row(f.data() + y * width, width, f.visible_row(y));
+                                }
+                            });
+
+    advent::parallel_ranges((width + 63) / 64, threads,
+                            [&](size_t begin, size_t end)
+                            {
+                                const size_t first = begin * 64;
+                                const size_t count = std::min(end * 64, width) - first;
+
+                                std::vector<uint8_t> tallest(count, 0);
+                                for (size_t y = 0; y < height; ++y)
+                                {
+                                    sweep_columns(f.data() + y * width + first, tallest.data(), count, f.visible_row(y) + begin);
+                                }
+
+                                std::fill(tallest.begin(), tallest.end(), 0);
+                                for (size_t y = height; y-- > 0;)
+                                {
+                                    sweep_columns(f.data() + y * width + first, tallest.data(), count, f.visible_row(y) + begin);
+                                }
+                            });
+}
+
+void mark_visible_trees_scalar(FlatForest& f, size_t threads = 1)
+{
+    mark_visible_trees(f, sweep_row_scalar, sweep_columns_scalar, threads);
+}
+
+void mark_visible_trees(FlatForest& f, size_t threads = 1)
+{
+#ifdef DAY_8_AVX2
+    if (advent::has_avx2())
+    {
+        mark_visible_trees(f, sweep_row_avx2, sweep_columns_avx2, threads);
+        return;
+    }
+#endif
+    mark_visible_trees_scalar(f, threads);
+}
+
+// For a sweep along some line: nearest[h] is the position of the closest tree
+// so far at least h tall (or the edge). A tree of height h can see back to
+// nearest[h], and then blocks the view for every height up to its own.
+template <class IndexT> IndexT see_and_block(IndexT* nearest, uint8_t h, IndexT position)
+{
+    assert(h <= 9);
+    const IndexT blocker = nearest[h];
+    for (uint8_t g = 0; g <= h; ++g)
+    {
+        nearest[g] = position;
+    }
+    return blocker;
+}
+
+// The nearest blocker sweeps of the columns [begin, end): going down the rows,
+// up(y, x, distance) is given how far each tree can see up, then going back
+// up, down(y, x, distance) how far it can see down. Both read the grid in
+// memory order.
+template <class UpF, class DownF> void sweep_columns(const FlatForest& f, size_t begin, size_t end, const UpF& up, const DownF& down)
+{
+    std::vector<uint32_t> nearest((end - begin) * 10, 0);
+    for (size_t y = 0; y < f.height(); ++y)
+    {
+        const auto row = f.row(y);
+        const auto y32 = static_cast<uint32_t>(y);
+        for (size_t x = begin; x < end; ++x)
+        {
+            up(y, x, y32 - see_and_block(&nearest[(x - begin) * 10], row[x], y32));
+        }
+    }
+
+    std::fill(nearest.begin(), nearest.end(), static_cast<uint32_t>(f.height() - 1));
+    for (size_t y = f.height(); y-- > 0;)
+    {
+        const auto row = f.row(y);
+        const auto y32 = static_cast<uint32_t>(y);
+        for (size_t x = begin; x < end; ++x)
+        {
+            down(y, x, see_and_block(&nearest[(x - begin) * 10], row[x], y32) - y32);
+        }
+    }
+}
+
+// The same along row y: right to left, right(x, distance) is given how far
+// each tree can see right, then left to right, left(x, distance) how far it
+// can see left
+template <class RightF, class LeftF> void sweep_row(const FlatForest& f, size_t y, const RightF& right, const LeftF& left)
+{
+    const auto row = f.row(y);
+
+    std::array<uint32_t, 10> nearest;
+    nearest.fill(static_cast<uint32_t>(f.width() - 1));
+    for (size_t x = f.width(); x-- > 0;)
+    {
+        const auto x32 = static_cast<uint32_t>(x);
+        right(x, see_and_block(nearest.data(), row[x], x32) - x32);
+    }
+
+    nearest.fill(0);
+    for (size_t x = 0; x < f.width(); ++x)
+    {
+        const auto x32 = static_cast<uint32_t>(x);
+        left(x, x32 - see_and_block(nearest.data(), row[x], x32));
+    }
+}
+
+// The best scenic score in the forest, in three passes that all read the grid
+// in memory order, keeping the nearest blockers of every column or row: down
+// the rows, recording how far each tree can see up; back up the rows,
+// multiplying in how far it can see down; then along each row for left and
+// right, and so the score. The first two passes split the columns between
+// threads, and the last splits the rows.
+size_t best_scenic_score(const FlatForest& f, size_t threads = 1)
+{
+    const size_t width  = f.width();
+    const size_t height = f.height();
+    if (width == 0 || height == 0)
+    {
+        return 0;
+    }
+
+    // up * down, which can pass 32 bits for a tall enough forest
+    std::vector<uint64_t> vertical(width * height);
+    advent::parallel_ranges(width, threads,
+                            [&](size_t begin, size_t end)
+                            {
+                                sweep_columns(
+                                    f, begin, end, [&](size_t y, size_t x, uint32_t up) { vertical[y * width + x] = up; },
+                                    [&](size_t y, size_t x, uint32_t down) { vertical[y * width + x] *= down; });
+                            });
+
+    size_t best = 0;
+    std::mutex best_mutex;
+    advent::parallel_ranges(height, threads,
+                            [&](size_t begin, size_t end)
+                            {
+                                size_t local_best = 0;
+                                std::vector<uint32_t> right(width);
+                                for (size_t y = begin; y < end; ++y)
+                                {
+                                    sweep_row(
+                                        f, y, [&](size_t x, uint32_t distance) { right[x] = distance; },
+                                        [&](size_t x, uint32_t left)
+                                        {
+                                            const uint64_t score = uint64_t(left) * right[x] * vertical[y * width + x];
+                                            local_best           = std::max<size_t>(local_best, score);
+                                        });
+                                }
+
+                                std::lock_guard<std::mutex> lock(best_mutex);
+                                best = std::max(best, local_best);
+                            });
+
+    return best;
+}
+
+// Viewing distances of every tree in a fixed forest, in each direction, so the
+// scenic score of any tree is a lookup. They are found with the same nearest
+// blocker sweeps as best_scenic_score, in O(10 * trees).
+class ScenicIndex
+{
+  public:
+    enum Direction
+    {
+        UP,
+        DOWN,
+        LEFT,
+        RIGHT
+    };
+
+    // A tree and its score, as found by top()
+    struct Entry
+    {
+        size_t score;
+        size_t y;
+        size_t x;
+    };
+
+    explicit ScenicIndex(const FlatForest& f, size_t threads = 1) : m_width(f.width()), m_height(f.height()), m_views(m_width * m_height)
+    {
+        if (m_width == 0 || m_height == 0)
+        {
+            return;
+        }
+
+        advent::parallel_ranges(m_width, threads,
+                                [&](size_t begin, size_t end)
+                                {
+                                    sweep_columns(
+                                        f, begin, end,
+                                        [&](size_t y, size_t x, uint32_t distance) { m_views[y * m_width + x][UP] = distance; },
+                                        [&](size_t y, size_t x, uint32_t distance) { m_views[y * m_width + x][DOWN] = distance; });
+                                });
+
+        advent::parallel_ranges(m_height, threads,
+                                [&](size_t begin, size_t end)
+                                {
+                                    for (size_t y = begin; y < end; ++y)
+                                    {
+                                        sweep_row(
+                                            f, y, [&](size_t x, uint32_t distance) { m_views[y * m_width + x][RIGHT] = distance; },
+                                            [&](size_t x, uint32_t distance) { m_views[y * m_width + x][LEFT] = distance; });
+                                    }
+                                });
+    }
+
+    size_t width() const { return m_width; }
+    size_t height() const { return m_height; }
+
+    // How many trees (y, x) can see looking in direction d
+    size_t distance(size_t y, size_t x, Direction d) const { return m_views[y * m_width + x][d]; }
 
-    auto forest = read_input(in);
+    size_t scenic_score(size_t y, size_t x) const
+    {
+        const auto& views = m_views[y * m_width + x];
+        return size_t(views[UP]) * views[DOWN] * views[LEFT] * views[RIGHT];
+    }
+
+    // The k best scoring trees, best first; ties go to the earlier tree in
+    // row-major order
+    std::vector<Entry> top(size_t k) const
+    {
+        std::vector<Entry> entries;
+        entries.reserve(m_views.size());
+        for (size_t y = 0; y < m_height; ++y)
+        {
+            for (size_t x = 0; x < m_width; ++x)
+            {
+                entries.push_back({scenic_score(y, x), y, x});
+            }
+        }
+
+        const auto better = [](const Entry& a, const Entry& b)
+        { return a.score != b.score ? a.score > b.score : std::make_pair(a.y, a.x) < std::make_pair(b.y, b.x); };
+
+        k = std::min(k, entries.size());
+        std::nth_element(entries.begin(), entries.begin() + k, entries.end(), better);
+        entries.resize(k);
+        std::sort(entries.begin(), entries.end(), better);
+        return entries;
+    }
+
+  private:
+    size_t m_width  = 0;
+    size_t m_height = 0;
+
+    // Distances up, down, left and right of each tree, in row-major order
+    std::vector<std::array<uint32_t, 4>> m_views;
+};
+
+FlatForest random_forest(size_t width, size_t height, unsigned seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<int> dist(0, 9);
+
+    std::vector<uint8_t> heights(width * height);
+    for (auto& h : heights)
+    {
+        h = static_cast<uint8_t>(dist(gen));
+    }
+    return FlatForest(width, std::move(heights));
+}
+
+// Same trees as f, as a Forest
+Forest to_forest(const FlatForest& f)
+{
+    Forest result(f.height(), std::vector<Tree>(f.width()));
+    for (size_t y = 0; y < f.height(); ++y)
+    {
+        for (size_t x = 0; x < f.width(); ++x)
+        {
+            result[y][x] = Tree(f.at(y, x), false);
+        }
+    }
+    return result;
+}
+
+TEST(Day8, ScenicScoresMatchWalk)
+{
+    std::stringstream ss_in;
+    for (size_t y = 0; y < 40; ++y)
+    {
+        for (size_t x = 0; x < 40; ++x)
+        {
+            ss_in << (y * 7 + x * x * 3 + (x ^ y)) % 10;
+        }
+        ss_in << "\n";
+    }
+
+    auto forest = read_input(ss_in);
+    auto marked = forest;
+    mark_visible_trees(marked);
 
-    size_t best_score = 0;
-    for (size_t i = 0; i < forest.size(); ++i)
+    const auto scores = scenic_scores(forest);
+    for (size_t y = 0; y < forest.size(); ++y)
     {
-        for (size_t j = 0; j < forest.size(); ++j)
+        for (size_t x = 0; x < forest.size(); ++x)
         {
-            best_score = std::max(best_score, scenic_score(forest, i, j));
+            EXPECT_EQ(scores[y][x], scenic_score(forest, y, x)) << y << ", " << x;
+            EXPECT_EQ(forest[y][x].second, marked[y][x].second) << y << ", " << x;
         }
     }
+}
+
+TEST(Day8, FlatForestMatchesForest)
+{
+    for (const unsigned seed : {1, 2, 3})
+    {
+        auto flat   = random_forest(37, 37, seed);
+        auto forest = to_forest(flat);
+
+        const auto scores = scenic_scores(forest);
+        mark_visible_trees(flat);
+
+        size_t best_score = 0;
+        for (size_t y = 0; y < flat.height(); ++y)
+        {
+            for (size_t x = 0; x < flat.width(); ++x)
+            {
+                EXPECT_EQ(flat.visible(y, x), forest[y][x].second) << y << ", " << x;
+                best_score = std::max(best_score, scores[y][x]);
+            }
+        }
+
+        EXPECT_EQ(flat.count_visible(), count_visible_trees(forest));
+        EXPECT_EQ(best_scenic_score(flat), best_score);
+        EXPECT_EQ(best_scenic_score(flat, 4), best_score);
+    }
+}
+
+TEST(Day8, RectangularForest)
+{
+    for (const auto& size : std::vector<std::pair<size_t, size_t>> {{23, 9}, {9, 23}, {70, 1}, {1, 70}})
+    {
+        const auto flat = random_forest(size.first, size.second, 7);
+
+        std::string text;
+        for (size_t y = 0; y < flat.height(); ++y)
+        {
+            for (size_t x = 0; x < flat.width(); ++x)
+            {
+                text += static_cast<char>('0' + flat.at(y, x));
+            }
+            text += y % 2 ? "\r\n" : "\n";
+        }
+
+        std::stringstream ss_in(text);
+        auto forest = read_input(ss_in);
+        auto marked = forest;
+        mark_visible_trees(marked);
+
+        const auto scores = scenic_scores(forest);
+        size_t best_score = 0;
+        for (size_t y = 0; y < forest.size(); ++y)
+        {
+            for (size_t x = 0; x < forest[y].size(); ++x)
+            {
+                EXPECT_EQ(scores[y][x], scenic_score(forest, y, x)) << y << ", " << x;
+                EXPECT_EQ(forest[y][x].second, marked[y][x].second) << y << ", " << x;
+                best_score = std::max(best_score, scores[y][x]);
+            }
+        }
+
+        // Block sizes that split rows, and the line endings, between reads
+        for (const size_t block_size : {1, 7, 1 << 16})
+        {
+            std::stringstream flat_in(text + "\n99\n");
+            auto read = read_flat_input(flat_in, block_size);
+
+            ASSERT_EQ(read.width(), flat.width());
+            ASSERT_EQ(read.height(), flat.height());
+            EXPECT_TRUE(std::equal(read.data(), read.data() + read.width() * read.height(), flat.data()));
+
+            mark_visible_trees(read);
+            EXPECT_EQ(read.count_visible(), count_visible_trees(forest));
+            EXPECT_EQ(best_scenic_score(read), best_score);
+        }
+    }
+
+    // Trailing whitespace is dropped, but nothing else that is not a digit
+    std::stringstream spaced("30373 \n25512\t\n65332 \r\n33549\n35390  \n");
+    auto trimmed = read_flat_input(spaced, 3);
+    EXPECT_EQ(trimmed.width(), 5u);
+    EXPECT_EQ(trimmed.height(), 5u);
+    EXPECT_EQ(best_scenic_score(trimmed), 8u);
+    mark_visible_trees(trimmed);
+    EXPECT_EQ(trimmed.count_visible(), 21u);
+
+    std::stringstream ragged("123\n4567\n");
+    EXPECT_THROW(read_flat_input(ragged), std::runtime_error);
+
+    for (const char* bad : {"123\n4x6\n", "123\n 456\n", "1 3\n456\n", "123\n456\n7a9"})
+    {
+        std::stringstream bad_in(bad);
+        EXPECT_THROW(read_flat_input(bad_in), std::runtime_error) << bad;
+    }
+}
+
+TEST(Day8, ScenicIndex)
+{
+    for (const auto& size : std::vector<std::pair<size_t, size_t>> {{1, 1}, {37, 37}, {23, 9}, {9, 41}})
+    {
+        const auto flat   = random_forest(size.first, size.second, 11);
+        auto forest       = to_forest(flat);
+        const auto scores = scenic_scores(forest);
+
+        const ScenicIndex index(flat, 3);
+
+        std::vector<size_t> all_scores;
+        for (size_t y = 0; y < flat.height(); ++y)
+        {
+            for (size_t x = 0; x < flat.width(); ++x)
+            {
+                EXPECT_EQ(index.scenic_score(y, x), scores[y][x]) << y << ", " << x;
+                all_scores.push_back(scores[y][x]);
+            }
+        }
+        std::sort(all_scores.rbegin(), all_scores.rend());
+
+        const auto top = index.top(20);
+        ASSERT_EQ(top.size(), std::min<size_t>(20, all_scores.size()));
+        for (size_t i = 0; i < top.size(); ++i)
+        {
+            EXPECT_EQ(top[i].score, all_scores[i]);
+            EXPECT_EQ(top[i].score, index.scenic_score(top[i].y, top[i].x));
+        }
+        EXPECT_EQ(index.top(1).front().score, best_scenic_score(flat));
+    }
+
+    // Rows from the example
+    std::stringstream ss_in("30373\n25512\n65332\n33549\n35390\n");
+    const ScenicIndex index(read_flat_input(ss_in));
+    EXPECT_EQ(index.distance(3, 2, ScenicIndex::UP), 2u);
+    EXPECT_EQ(index.distance(3, 2, ScenicIndex::LEFT), 2u);
+    EXPECT_EQ(index.distance(3, 2, ScenicIndex::DOWN), 1u);
+    EXPECT_EQ(index.distance(3, 2, ScenicIndex::RIGHT), 2u);
+    EXPECT_EQ(index.scenic_score(3, 2), 8u);
+}
+
+TEST(Day8, TallForestScores)
+{
+    // A 3 wide column, tall enough that up * down of a tree passes 32 bits;
+    // the tallest tree in the middle of the middle column sees every tree
+    std::vector<uint8_t> heights(3 * 140001, 0);
+    heights[3 * 70000 + 1] = 9;
+    const FlatForest flat(3, std::move(heights));
+
+    EXPECT_EQ(best_scenic_score(flat), uint64_t(70000) * 70000);
+    EXPECT_EQ(best_scenic_score(flat), ScenicIndex(flat).top(1).front().score);
+}
+
+TEST(Day8, VisibilityKernels)
+{
+    const std::vector<std::pair<size_t, size_t>> SIZES {{1, 1}, {5, 5}, {37, 53}, {100, 3}, {3, 100}, {64, 64}, {97, 130}};
+
+    unsigned seed = 0;
+    for (const auto& size : SIZES)
+    {
+        auto scalar = random_forest(size.first, size.second, ++seed);
+        auto fast   = scalar;
+
+        auto threaded = scalar;
+
+        mark_visible_trees_scalar(scalar);
+        mark_visible_trees(fast);
+        mark_visible_trees(threaded, 3);
+
+        EXPECT_EQ(fast.count_visible(), scalar.count_visible()) << size.first << "x" << size.second;
+        for (size_t y = 0; y < scalar.height(); ++y)
+        {
+            for (size_t x = 0; x < scalar.width(); ++x)
+            {
+                EXPECT_EQ(fast.visible(y, x), scalar.visible(y, x)) << y << ", " << x;
+                EXPECT_EQ(threaded.visible(y, x), scalar.visible(y, x)) << y << ", " << x;
+            }
+        }
+    }
+}
+
+// Not run by default; use --gtest_also_run_disabled_tests
+TEST(Day8, DISABLED_BenchmarkFlatForest)
+{
+    // Forest of pairs is too big to hold at full size, so it is timed on a
+    // sixteenth of the trees
+    constexpr size_t SIZE = 10000;
+
+    auto flat = random_forest(SIZE, SIZE, 42);
+
+    auto start = std::chrono::steady_clock::now();
+    mark_visible_trees(flat);
+    const auto visible = flat.count_visible();
+    const auto best    = best_scenic_score(flat);
+
+    const std::chrono::duration<double> flat_time = std::chrono::steady_clock::now() - start;
+
+    auto forest = to_forest(random_forest(SIZE / 4, SIZE / 4, 42));
+
+    start = std::chrono::steady_clock::now();
+    scenic_scores(forest);
+    const std::chrono::duration<double> forest_time = std::chrono::steady_clock::now() - start;
+
+    auto threaded = random_forest(SIZE, SIZE, 42);
+    const auto threads = advent::thread_count();
+
+    start = std::chrono::steady_clock::now();
+    mark_visible_trees(threaded, threads);
+    EXPECT_EQ(threaded.count_visible(), visible);
+    EXPECT_EQ(best_scenic_score(threaded, threads), best);
+    const std::chrono::duration<double> threaded_time = std::chrono::steady_clock::now() - start;
+
+    std::cout << visible << " visible, best score " << best << std::endl;
+    std::cout << "FlatForest on " << threads << " threads: " << threaded_time.count() << "s" << std::endl;
+    std::cout << "FlatForest " << SIZE << "x" << SIZE << ": " << flat_time.count() << "s, Forest " << SIZE / 4 << "x" << SIZE / 4
+              << ": " << forest_time.count() << "s" << std::endl;
+}
+}
+
+void day_8(std::istream& in, std::ostream& out)
+{
+    using namespace day_8_impl;
+
+    auto forest = read_flat_input(in);
+    mark_visible_trees(forest, advent::thread_count());
+
+    out << forest.count_visible();
+}
+
+void day_8_adv(std::istream& in, std::ostream& out)
+{
+    using namespace day_8_impl;
+
+    const auto forest = read_flat_input(in);
 
-    out << best_score;
+    out << best_scenic_score(forest, advent::thread_count());
 }
 
 TEST(Day8, Example)
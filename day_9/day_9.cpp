@@ -1,9 +1,29 @@
 #include <iostream>
+#include <algorithm>
+#include <array>
+#include <bitset>
 #include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <random>
 #include <set>
+#include <stdexcept>
+#include <vector>
 
 #include <gtest/gtest.h>
 
+#include "cpu.h"
+#include "packed_input.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define DAY_9_AVX2 1
+#include <immintrin.h>
+#endif
+
 namespace day_9_impl
 {
 enum class Direction
@@ -18,7 +38,9 @@ using Command    = std::pair<Direction, size_t>;
 using Coordinate = std::pair<int, int>;
 using Rope       = std::vector<Coordinate>;
 
-std::vector<Command> read_input(std::istream& in)
+// Reads the commands with formatted input; kept to check and time the packed
+// parser against
+std::vector<Command> read_input_formatted(std::istream& in)
 {
     std::vector<Command> result;
 
@@ -49,6 +71,116 @@ std::vector<Command> read_input(std::istream& in)
     return result;
 }
 
+// A command in 32 bits: the direction in the top two, and the distance in the
+// rest
+using PackedCommand = uint32_t;
+
+constexpr uint32_t MAX_DISTANCE = (uint32_t(1) << 30) - 1;
+
+PackedCommand pack(const Command& c)
+{
+    assert(c.second <= MAX_DISTANCE);
+    return static_cast<uint32_t>(c.first) << 30 | static_cast<uint32_t>(c.second);
+}
+
+Command unpack(PackedCommand c)
+{
+    return {static_cast<Direction>(c >> 30), c & MAX_DISTANCE};
+}
+
+std::vector<Command> unpack(const std::vector<PackedCommand>& packed)
+{
+    std::vector<Command> result;
+    result.reserve(packed.size());
+    std::transform(packed.begin(), packed.end(), std::back_inserter(result), [](PackedCommand c) { return unpack(c); });
+    return result;
+}
+
+// Either form of a command as a Command, so the simulations can run on
+// commands kept packed
+inline const Command& as_command(const Command& c)
+{
+    return c;
+}
+
+inline Command as_command(PackedCommand c)
+{
+    return unpack(c);
+}
+
+// One command, e.g. "R 4", from [begin, end) with no surrounding whitespace
+PackedCommand parse_command(const char* begin, const char* end)
+{
+    const auto fail = [&] { throw std::runtime_error("bad command: " + std::string(begin, end)); };
+
+    if (end - begin < 3)
+    {
+        fail();
+    }
+
+    uint32_t direction = 0;
+    switch (*begin)
+    {
+    case 'U':
+        direction = static_cast<uint32_t>(Direction::UP);
+        break;
+    case 'D':
+        direction = static_cast<uint32_t>(Direction::DOWN);
+        break;
+    case 'L':
+        direction = static_cast<uint32_t>(Direction::LEFT);
+        break;
+    case 'R':
+        direction = static_cast<uint32_t>(Direction::RIGHT);
+        break;
+    default:
+        fail();
+    }
+
+    const char* curr = begin + 1;
+    while (curr != end && advent::is_space(*curr))
+    {
+        ++curr;
+    }
+
+    uint64_t distance = 0;
+    const char* digits = curr;
+    for (; curr != end && *curr >= '0' && *curr <= '9' && distance <= MAX_DISTANCE; ++curr)
+    {
+        distance = distance * 10 + static_cast<uint32_t>(*curr - '0');
+    }
+    if (curr == digits || curr != end || distance > MAX_DISTANCE)
+    {
+        fail();
+    }
+
+    return direction << 30 | static_cast<uint32_t>(distance);
+}
+
+// Marks a cache of packed commands as this day's; see advent::CacheHeader
+constexpr char CACHE_MAGIC[8] = {'A', 'O', 'C', '9', 'R', 'O', 'P', 'E'};
+
+void write_cache(std::ostream& out, const std::vector<PackedCommand>& commands)
+{
+    advent::write_cache(out, CACHE_MAGIC, commands);
+}
+
+// Reads packed commands from either the puzzle's text, parsed a block at a
+// time, or a cache written by write_cache
+std::vector<PackedCommand> read_packed(std::istream& in, size_t block_size = 1 << 16)
+{
+    return advent::read_packed<PackedCommand>(in, CACHE_MAGIC, parse_command, block_size);
+}
+
+// Reads the commands, and saves them to the file named by ADVENT_CACHE if it
+// is set. They are kept packed, as the simulations can run on them that way.
+std::vector<PackedCommand> read_input(std::istream& in)
+{
+    std::vector<PackedCommand> result;
+    advent::for_each_cached<PackedCommand>(in, CACHE_MAGIC, parse_command, [&](PackedCommand c) { result.push_back(c); });
+    return result;
+}
+
 Coordinate step(Direction d, Coordinate start)
 {
     // Move the head
@@ -84,7 +216,512 @@ Coordinate update(Coordinate head, Coordinate tail)
     return tail;
 }
 
-size_t count_tail_locations(const std::vector<Command>& commands, size_t rope_length)
+// The corners of the area the head passes through. No knot ever leaves it:
+// each one only steps towards the knot in front, so stays between where it
+// was and where that knot is.
+struct Bounds
+{
+    Coordinate min;
+    Coordinate max;
+};
+
+template <class CommandsT> Bounds head_bounds(const CommandsT& commands)
+{
+    Coordinate head {0, 0};
+    Bounds result {head, head};
+
+    for (const auto& command : commands)
+    {
+        const Command& c = as_command(command);
+        const int dist = static_cast<int>(c.second);
+        switch (c.first)
+        {
+        case Direction::UP:
+            head.second += dist;
+            break;
+        case Direction::DOWN:
+            head.second -= dist;
+            break;
+        case Direction::LEFT:
+            head.first -= dist;
+            break;
+        case Direction::RIGHT:
+            head.first += dist;
+            break;
+        }
+
+        result.min = {std::min(result.min.first, head.first), std::min(result.min.second, head.second)};
+        result.max = {std::max(result.max.first, head.first), std::max(result.max.second, head.second)};
+    }
+    return result;
+}
+
+// Set of coordinates inside known bounds. When the bounds are small enough it
+// is a bitmap with one bit per coordinate; otherwise an open-addressing hash
+// set of coordinates packed into 64 bits, relative to the bounds' minimum.
+class VisitedSet
+{
+  public:
+    // A bitmap of up to 32MiB
+    static constexpr size_t MAX_BITMAP_CELLS = size_t(1) << 28;
+
+    explicit VisitedSet(const Bounds& bounds, size_t max_bitmap_cells = MAX_BITMAP_CELLS)
+        : m_min(bounds.min), m_width(uint64_t(int64_t(bounds.max.first) - bounds.min.first) + 1),
+          m_height(uint64_t(int64_t(bounds.max.second) - bounds.min.second) + 1)
+    {
+        if (m_width * m_height <= max_bitmap_cells)
+        {
+            m_bitmap.resize((m_width * m_height + 63) / 64, 0);
+        }
+        else
+        {
+            m_slots.resize(1024, EMPTY);
+        }
+    }
+
+    bool uses_bitmap() const { return !m_bitmap.empty(); }
+
+    // Adds c, which must be inside the bounds; returns whether it was new
+    bool insert(Coordinate c)
+    {
+        const uint64_t x = uint64_t(int64_t(c.first) - m_min.first);
+        const uint64_t y = uint64_t(int64_t(c.second) - m_min.second);
+        assert(x < m_width && y < m_height);
+
+        if (uses_bitmap())
+        {
+            const uint64_t index = y * m_width + x;
+            const uint64_t bit   = uint64_t(1) << (index % 64);
+
+            uint64_t& word  = m_bitmap[index / 64];
+            const bool seen = word & bit;
+            word |= bit;
+            m_size += !seen;
+            return !seen;
+        }
+
+        if (insert_key(x << 32 | y))
+        {
+            ++m_size;
+            if (m_size * 2 > m_slots.size())
+            {
+                grow();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    // Adds the length coordinates from start onwards in direction d, which
+    // must all be inside the bounds. Along a row of the bitmap, whole words
+    // are set at a time.
+    void insert_line(Coordinate start, Direction d, size_t length)
+    {
+        if (length == 0)
+        {
+            return;
+        }
+
+        if (uses_bitmap() && (d == Direction::LEFT || d == Direction::RIGHT))
+        {
+            const int64_t first_x = d == Direction::RIGHT ? start.first : int64_t(start.first) - int64_t(length - 1);
+            assert(first_x >= m_min.first && uint64_t(first_x - m_min.first) + length <= m_width);
+
+            set_bits(uint64_t(int64_t(start.second) - m_min.second) * m_width + uint64_t(first_x - m_min.first), length);
+            return;
+        }
+
+        for (size_t i = 0; i < length; ++i, start = step(d, start))
+        {
+            insert(start);
+        }
+    }
+
+    size_t size() const { return m_size; }
+
+  private:
+    void set_bits(uint64_t first, uint64_t count)
+    {
+        while (count > 0)
+        {
+            const uint64_t shift = first % 64;
+            const uint64_t bits  = std::min<uint64_t>(count, 64 - shift);
+            const uint64_t mask  = (bits == 64 ? ~uint64_t(0) : (uint64_t(1) << bits) - 1) << shift;
+
+            uint64_t& word = m_bitmap[first / 64];
+            m_size += std::bitset<64>(mask & ~word).count();
+            word |= mask;
+
+            first += bits;
+            count -= bits;
+        }
+    }
+
+    // Relative coordinates are under 2^32, so can never pack to this
+    static constexpr uint64_t EMPTY = ~uint64_t(0);
+
+    static size_t hash(uint64_t key) { return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 32); }
+
+    bool insert_key(uint64_t key)
+    {
+        const size_t mask = m_slots.size() - 1;
+        for (size_t slot = hash(key) & mask;; slot = (slot + 1) & mask)
+        {
+            if (m_slots[slot] == key)
+            {
+                return false;
+            }
+            if (m_slots[slot] == EMPTY)
+            {
+                m_slots[slot] = key;
+                return true;
+            }
+        }
+    }
+
+    void grow()
+    {
+        std::vector<uint64_t> old(m_slots.size() * 2, EMPTY);
+        std::swap(old, m_slots);
+        for (const auto key : old)
+        {
+            if (key != EMPTY)
+            {
+                insert_key(key);
+            }
+        }
+    }
+
+    Coordinate m_min;
+    uint64_t m_width;
+    uint64_t m_height;
+    size_t m_size = 0;
+
+    std::vector<uint64_t> m_bitmap;
+    std::vector<uint64_t> m_slots;
+};
+
+size_t count_tail_locations(const std::vector<Command>& commands, size_t rope_length,
+                            size_t max_bitmap_cells = VisitedSet::MAX_BITMAP_CELLS)
+{
+    Rope r(rope_length, {0, 0});
+
+    VisitedSet tail_locations(head_bounds(commands), max_bitmap_cells);
+    tail_locations.insert(r.back());
+
+    for (const auto& c : commands)
+    {
+        for (size_t i = 0; i < c.second; ++i)
+        {
+            r.front() = step(c.first, r.front());
+            for (size_t j = 1; j < r.size(); ++j)
+            {
+                r[j] = update(r[j - 1], r[j]);
+            }
+
+            tail_locations.insert(r.back());
+        }
+    }
+
+    return tail_locations.size();
+}
+
+// Whether each knot is one step behind the one in front, in direction d, so
+// that moving the head on in that direction just moves every knot the same way
+bool stretched(const Rope& r, Direction d)
+{
+    const Coordinate unit = step(d, {0, 0});
+    for (size_t j = 1; j < r.size(); ++j)
+    {
+        if (r[j - 1].first - r[j].first != unit.first || r[j - 1].second - r[j].second != unit.second)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The number of locations visited by the tail of a rope of each of the given
+// lengths, in the same order, from one simulation of the longest: the first
+// knots of a long rope move exactly like a shorter rope.
+//
+// Once the rope is stretched out straight along a move, the rest of the move
+// is done in one go, marking the line each tracked knot covers. A long move
+// then costs one step per knot to straighten the rope, rather than one per
+// knot per unit of distance, plus marking the lines.
+template <class CommandsT>
+std::vector<size_t> count_knot_locations(const CommandsT& commands, const std::vector<size_t>& rope_lengths,
+                                         size_t max_bitmap_cells = VisitedSet::MAX_BITMAP_CELLS)
+{
+    if (rope_lengths.empty())
+    {
+        return {};
+    }
+
+    Rope r(*std::max_element(rope_lengths.begin(), rope_lengths.end()), {0, 0});
+
+    const auto bounds = head_bounds(commands);
+    std::vector<VisitedSet> locations;
+    for (const auto length : rope_lengths)
+    {
+        assert(length > 0);
+        locations.emplace_back(bounds, max_bitmap_cells);
+        locations.back().insert(r[length - 1]);
+    }
+
+    for (const auto& command : commands)
+    {
+        const Command& c = as_command(command);
+        for (size_t i = 0; i < c.second; ++i)
+        {
+            if (stretched(r, c.first))
+            {
+                const int remaining   = static_cast<int>(c.second - i);
+                const Coordinate unit = step(c.first, {0, 0});
+
+                for (size_t k = 0; k < rope_lengths.size(); ++k)
+                {
+                    locations[k].insert_line(step(c.first, r[rope_lengths[k] - 1]), c.first, remaining);
+                }
+                for (auto& knot : r)
+                {
+                    knot.first += unit.first * remaining;
+                    knot.second += unit.second * remaining;
+                }
+                break;
+            }
+
+            r.front() = step(c.first, r.front());
+            for (size_t j = 1; j < r.size(); ++j)
+            {
+                r[j] = update(r[j - 1], r[j]);
+            }
+
+            for (size_t k = 0; k < rope_lengths.size(); ++k)
+            {
+                locations[k].insert(r[rope_lengths[k] - 1]);
+            }
+        }
+    }
+
+    std::vector<size_t> result;
+    for (const auto& visited : locations)
+    {
+        result.push_back(visited.size());
+    }
+    return result;
+}
+
+// As count_tail_locations, moving the rope a whole command at a time once it
+// is stretched out straight; the commands may be kept packed
+template <class CommandsT>
+size_t count_tail_locations_runs(const CommandsT& commands, size_t rope_length, size_t max_bitmap_cells = VisitedSet::MAX_BITMAP_CELLS)
+{
+    return count_knot_locations(commands, {rope_length}, max_bitmap_cells).front();
+}
+
+inline int sign(int v)
+{
+    return (v > 0) - (v < 0);
+}
+
+// Same as update, without branches: the tail moves by the sign of each gap,
+// masked off unless either gap is 2 or more (i.e. dx + 1 is outside [0, 2])
+inline Coordinate update_branch_free(Coordinate head, Coordinate tail)
+{
+    const int dx   = head.first - tail.first;
+    const int dy   = head.second - tail.second;
+    const int move = -static_cast<int>((unsigned(dx + 1) > 2u) | (unsigned(dy + 1) > 2u));
+
+    tail.first += sign(dx) & move;
+    tail.second += sign(dy) & move;
+    return tail;
+}
+
+// A rope of N knots with the x and y coordinates in separate arrays
+template <size_t N> struct FixedRope
+{
+    static_assert(N > 0, "A rope needs a head");
+
+    std::array<int, N> x {};
+    std::array<int, N> y {};
+
+    // Move the head by (dx, dy), and the rest of the knots after it
+    void move(int dx, int dy)
+    {
+        x[0] += dx;
+        y[0] += dy;
+        for (size_t j = 1; j < N; ++j)
+        {
+            const auto knot = update_branch_free({x[j - 1], y[j - 1]}, {x[j], y[j]});
+            x[j]            = knot.first;
+            y[j]            = knot.second;
+        }
+    }
+
+    Coordinate tail() const { return {x[N - 1], y[N - 1]}; }
+};
+
+template <size_t N>
+size_t count_tail_locations_fixed(const std::vector<Command>& commands, size_t max_bitmap_cells = VisitedSet::MAX_BITMAP_CELLS)
+{
+    FixedRope<N> r;
+
+    VisitedSet tail_locations(head_bounds(commands), max_bitmap_cells);
+    tail_locations.insert(r.tail());
+
+    for (const auto& c : commands)
+    {
+        const Coordinate unit = step(c.first, {0, 0});
+        for (size_t i = 0; i < c.second; ++i)
+        {
+            r.move(unit.first, unit.second);
+            tail_locations.insert(r.tail());
+        }
+    }
+
+    return tail_locations.size();
+}
+
+// LANES independent ropes of N knots, laid out so the same knot of every rope
+// is together and they can all be moved at once
+template <size_t N> struct RopeBatch
+{
+    static constexpr size_t LANES = 8;
+
+    alignas(32) int32_t x[N][LANES] = {};
+    alignas(32) int32_t y[N][LANES] = {};
+};
+
+// Moves the knots after the heads of every rope in the batch
+template <size_t N> void follow_scalar(RopeBatch<N>& b)
+{
+    for (size_t j = 1; j < N; ++j)
+    {
+        for (size_t lane = 0; lane < RopeBatch<N>::LANES; ++lane)
+        {
+            const auto knot = update_branch_free({b.x[j - 1][lane], b.y[j - 1][lane]}, {b.x[j][lane], b.y[j][lane]});
+            b.x[j][lane]    = knot.first;
+            b.y[j][lane]    = knot.second;
+        }
+    }
+}
+
+#ifdef DAY_9_AVX2
+template <size_t N> __attribute__((target("avx2"))) void follow_avx2(RopeBatch<N>& b)
+{
+    static_assert(RopeBatch<N>::LANES == 8, "One AVX2 register of lanes");
+
+    const __m256i one       = _mm256_set1_epi32(1);
+    const __m256i minus_one = _mm256_set1_epi32(-1);
+
+    __m256i head_x = _mm256_load_si256(reinterpret_cast<const __m256i*>(b.x[0]));
+    __m256i head_y = _mm256_load_si256(reinterpret_cast<const __m256i*>(b.y[0]));
+    for (size_t j = 1; j < N; ++j)
+    {
+        __m256i x = _mm256_load_si256(reinterpret_cast<const __m256i*>(b.x[j]));
+        __m256i y = _mm256_load_si256(reinterpret_cast<const __m256i*>(b.y[j]));
+
+        const __m256i dx   = _mm256_sub_epi32(head_x, x);
+        const __m256i dy   = _mm256_sub_epi32(head_y, y);
+        const __m256i move = _mm256_cmpgt_epi32(_mm256_max_epi32(_mm256_abs_epi32(dx), _mm256_abs_epi32(dy)), one);
+
+        x = _mm256_add_epi32(x, _mm256_and_si256(move, _mm256_min_epi32(_mm256_max_epi32(dx, minus_one), one)));
+        y = _mm256_add_epi32(y, _mm256_and_si256(move, _mm256_min_epi32(_mm256_max_epi32(dy, minus_one), one)));
+
+        _mm256_store_si256(reinterpret_cast<__m256i*>(b.x[j]), x);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(b.y[j]), y);
+        head_x = x;
+        head_y = y;
+    }
+}
+#endif
+
+// The number of tail locations for each of many ropes of N knots, each with
+// its own commands, simulated LANES ropes at a time
+template <size_t N> std::vector<size_t> count_tail_locations_batch(const std::vector<std::vector<Command>>& ropes, bool vectorized = true)
+{
+    constexpr size_t LANES = RopeBatch<N>::LANES;
+
+    auto follow = follow_scalar<N>;
+#ifdef DAY_9_AVX2
+    if (vectorized && advent::has_avx2())
+    {
+        follow = follow_avx2<N>;
+    }
+#endif
+
+    std::vector<size_t> result;
+    result.reserve(ropes.size());
+    for (size_t first = 0; first < ropes.size(); first += LANES)
+    {
+        const size_t lanes = std::min(LANES, ropes.size() - first);
+
+        RopeBatch<N> batch;
+        std::vector<VisitedSet> tail_locations;
+        for (size_t lane = 0; lane < lanes; ++lane)
+        {
+            tail_locations.emplace_back(head_bounds(ropes[first + lane]));
+            tail_locations.back().insert({0, 0});
+        }
+
+        // Each lane's next command, how far it has left to go on its current
+        // one, and which way; lanes that have finished stop still
+        std::array<size_t, LANES> next {};
+        std::array<size_t, LANES> remaining {};
+        std::array<Coordinate, LANES> unit {};
+
+        for (;;)
+        {
+            size_t moving = 0;
+            for (size_t lane = 0; lane < lanes; ++lane)
+            {
+                const auto& commands = ropes[first + lane];
+                while (remaining[lane] == 0 && next[lane] < commands.size())
+                {
+                    unit[lane]      = step(commands[next[lane]].first, {0, 0});
+                    remaining[lane] = commands[next[lane]].second;
+                    ++next[lane];
+                }
+
+                if (remaining[lane] == 0)
+                {
+                    unit[lane] = {0, 0};
+                    continue;
+                }
+
+                --remaining[lane];
+                ++moving;
+                batch.x[0][lane] += unit[lane].first;
+                batch.y[0][lane] += unit[lane].second;
+            }
+
+            if (moving == 0)
+            {
+                break;
+            }
+
+            follow(batch);
+            for (size_t lane = 0; lane < lanes; ++lane)
+            {
+                if (unit[lane] != Coordinate {0, 0})
+                {
+                    tail_locations[lane].insert({batch.x[N - 1][lane], batch.y[N - 1][lane]});
+                }
+            }
+        }
+
+        for (const auto& visited : tail_locations)
+        {
+            result.push_back(visited.size());
+        }
+    }
+    return result;
+}
+
+// The original simulation, keeping tail locations in a std::set; kept to check
+// and time the others against
+size_t count_tail_locations_set(const std::vector<Command>& commands, size_t rope_length)
 {
     Rope r(rope_length, {0, 0});
 
@@ -107,6 +744,291 @@ size_t count_tail_locations(const std::vector<Command>& commands, size_t rope_le
 
     return tail_locations.size();
 }
+
+// A random walk of moves, each up to max_distance long
+std::vector<Command> random_commands(size_t moves, size_t max_distance, unsigned seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<int> direction(0, 3);
+    std::uniform_int_distribution<size_t> distance(1, max_distance);
+
+    std::vector<Command> result;
+    result.reserve(moves);
+    for (size_t i = 0; i < moves; ++i)
+    {
+        result.emplace_back(static_cast<Direction>(direction(gen)), distance(gen));
+    }
+    return result;
+}
+
+TEST(Day9, PackedParser)
+{
+    const auto commands = random_commands(500, 1000000, 9);
+
+    std::string text;
+    for (size_t i = 0; i < commands.size(); ++i)
+    {
+        text += "UDLR"[static_cast<int>(commands[i].first)];
+        text += i % 3 ? " " : "  ";
+        text += std::to_string(commands[i].second);
+        text += i % 2 ? "\r\n" : "\n";
+    }
+    text.pop_back();
+
+    std::stringstream formatted_in(text);
+    ASSERT_EQ(read_input_formatted(formatted_in), commands);
+
+    for (const size_t block_size : {1, 7, 4096})
+    {
+        std::stringstream ss_in(text);
+        const auto packed = read_packed(ss_in, block_size);
+        EXPECT_EQ(unpack(packed), commands) << block_size;
+
+        std::stringstream cache;
+        write_cache(cache, packed);
+        EXPECT_EQ(read_packed(cache, block_size), packed) << block_size;
+    }
+
+    for (const char* bad : {"X 4\n", "R\n", "R 4x\n", "R 99999999999\n"})
+    {
+        std::stringstream ss_in(bad);
+        EXPECT_THROW(read_packed(ss_in), std::runtime_error) << bad;
+    }
+
+    std::stringstream truncated;
+    write_cache(truncated, {pack(commands[0]), pack(commands[1])});
+    std::stringstream short_cache(truncated.str().substr(0, truncated.str().size() - 1));
+    EXPECT_THROW(read_packed(short_cache), std::runtime_error);
+
+    // A corrupt count is caught by running out of commands, not by allocating it
+    for (const uint64_t count : {uint64_t(1) << 40, ~uint64_t(0)})
+    {
+        std::string text = truncated.str();
+        std::memcpy(&text[offsetof(advent::CacheHeader, count)], &count, sizeof(count));
+        std::stringstream corrupt(text);
+        EXPECT_THROW(read_packed(corrupt), std::runtime_error) << count;
+    }
+}
+
+TEST(Day9, VisitedSet)
+{
+    for (const unsigned seed : {1, 2, 3})
+    {
+        const auto commands = random_commands(2000, 20, seed);
+        for (const size_t knots : {2, 10})
+        {
+            const auto expected = count_tail_locations_set(commands, knots);
+            EXPECT_EQ(count_tail_locations(commands, knots), expected);
+            EXPECT_EQ(count_tail_locations(commands, knots, 0), expected);
+        }
+    }
+
+    VisitedSet bitmap({{-3, -2}, {4, 5}});
+    VisitedSet hashed({{-3, -2}, {4, 5}}, 0);
+    EXPECT_TRUE(bitmap.uses_bitmap());
+    EXPECT_FALSE(hashed.uses_bitmap());
+
+    for (auto* visited : {&bitmap, &hashed})
+    {
+        EXPECT_TRUE(visited->insert({-3, -2}));
+        EXPECT_TRUE(visited->insert({4, 5}));
+        EXPECT_FALSE(visited->insert({-3, -2}));
+        EXPECT_EQ(visited->size(), 2u);
+    }
+}
+
+TEST(Day9, RunLengthMoves)
+{
+    for (const unsigned seed : {1, 2, 3})
+    {
+        const auto commands = random_commands(500, 200, seed);
+
+        std::vector<PackedCommand> packed;
+        std::transform(commands.begin(), commands.end(), std::back_inserter(packed), [](const Command& c) { return pack(c); });
+
+        for (const size_t knots : {1, 2, 3, 10})
+        {
+            const auto expected = count_tail_locations(commands, knots);
+            EXPECT_EQ(count_tail_locations_runs(commands, knots), expected) << knots;
+            EXPECT_EQ(count_tail_locations_runs(commands, knots, 0), expected) << knots;
+            EXPECT_EQ(count_tail_locations_runs(packed, knots), expected) << knots;
+        }
+    }
+
+    // One long move: ten knots take nine steps to straighten out
+    const std::vector<Command> commands {{Direction::RIGHT, 1000000}, {Direction::UP, 3}, {Direction::LEFT, 1000000}};
+    EXPECT_EQ(count_tail_locations_runs(commands, 10), count_tail_locations_set(commands, 10));
+}
+
+TEST(Day9, SinglePassKnotCounts)
+{
+    const auto commands = random_commands(1000, 50, 5);
+
+    const std::vector<size_t> lengths {10, 2, 1, 5, 2};
+    const auto counts = count_knot_locations(commands, lengths);
+
+    ASSERT_EQ(counts.size(), lengths.size());
+    for (size_t k = 0; k < lengths.size(); ++k)
+    {
+        EXPECT_EQ(counts[k], count_tail_locations(commands, lengths[k])) << lengths[k];
+    }
+    EXPECT_TRUE(count_knot_locations(commands, {}).empty());
+}
+
+TEST(Day9, BranchFreeRopes)
+{
+    for (int dx = -2; dx <= 2; ++dx)
+    {
+        for (int dy = -2; dy <= 2; ++dy)
+        {
+            EXPECT_EQ(update_branch_free({dx, dy}, {0, 0}), update({dx, dy}, {0, 0})) << dx << ", " << dy;
+        }
+    }
+
+    std::vector<std::vector<Command>> ropes;
+    for (unsigned seed = 1; seed <= 11; ++seed)
+    {
+        ropes.push_back(random_commands(100 * seed, 20, seed));
+    }
+
+    std::vector<size_t> expected;
+    for (const auto& commands : ropes)
+    {
+        expected.push_back(count_tail_locations(commands, 10));
+        EXPECT_EQ(count_tail_locations_fixed<10>(commands), expected.back());
+        EXPECT_EQ(count_tail_locations_fixed<2>(commands), count_tail_locations(commands, 2));
+    }
+
+    EXPECT_EQ(count_tail_locations_batch<10>(ropes), expected);
+    EXPECT_EQ(count_tail_locations_batch<10>(ropes, false), expected);
+}
+
+// Not run by default; use --gtest_also_run_disabled_tests
+TEST(Day9, DISABLED_BenchmarkParser)
+{
+    std::stringstream text;
+    for (const auto& c : random_commands(10000000, 20, 42))
+    {
+        text << "UDLR"[static_cast<int>(c.first)] << ' ' << c.second << '\n';
+    }
+
+    std::stringstream formatted_in(text.str());
+    auto start           = std::chrono::steady_clock::now();
+    const auto formatted = read_input_formatted(formatted_in);
+
+    const std::chrono::duration<double> formatted_time = std::chrono::steady_clock::now() - start;
+
+    std::stringstream packed_in(text.str());
+    start             = std::chrono::steady_clock::now();
+    const auto packed = read_packed(packed_in);
+
+    const std::chrono::duration<double> packed_time = std::chrono::steady_clock::now() - start;
+
+    std::stringstream cache;
+    write_cache(cache, packed);
+    start             = std::chrono::steady_clock::now();
+    const auto cached = read_packed(cache);
+
+    const std::chrono::duration<double> cache_time = std::chrono::steady_clock::now() - start;
+
+    EXPECT_EQ(unpack(packed), formatted);
+    EXPECT_EQ(cached, packed);
+    std::cout << formatted.size() << " commands: formatted " << formatted_time.count() << "s, packed " << packed_time.count()
+              << "s, from cache " << cache_time.count() << "s" << std::endl;
+}
+
+// Not run by default; use --gtest_also_run_disabled_tests
+TEST(Day9, DISABLED_BenchmarkVisitedSet)
+{
+    const auto commands = random_commands(1000000, 10, 42);
+
+    for (const size_t knots : {2, 10})
+    {
+        auto start          = std::chrono::steady_clock::now();
+        const auto from_set = count_tail_locations_set(commands, knots);
+
+        const std::chrono::duration<double> set_time = std::chrono::steady_clock::now() - start;
+
+        start                = std::chrono::steady_clock::now();
+        const auto from_bits = count_tail_locations(commands, knots);
+
+        const std::chrono::duration<double> bitmap_time = std::chrono::steady_clock::now() - start;
+
+        start                = std::chrono::steady_clock::now();
+        const auto from_hash = count_tail_locations(commands, knots, 0);
+
+        const std::chrono::duration<double> hash_time = std::chrono::steady_clock::now() - start;
+
+        EXPECT_EQ(from_bits, from_set);
+        EXPECT_EQ(from_hash, from_set);
+
+        std::cout << knots << " knots, " << from_set << " locations: std::set " << set_time.count() << "s, bitmap "
+                  << bitmap_time.count() << "s, hash " << hash_time.count() << "s" << std::endl;
+    }
+}
+
+// Not run by default; use --gtest_also_run_disabled_tests
+TEST(Day9, DISABLED_BenchmarkLongMoves)
+{
+    // Sweeping back and forth across a wide strip
+    std::vector<Command> commands;
+    for (size_t i = 0; i < 50; ++i)
+    {
+        commands.emplace_back(Direction::RIGHT, 1000000);
+        commands.emplace_back(Direction::UP, 2);
+        commands.emplace_back(Direction::LEFT, 1000000);
+        commands.emplace_back(Direction::UP, 2);
+    }
+
+    auto start          = std::chrono::steady_clock::now();
+    const auto per_step = count_tail_locations(commands, 10);
+
+    const std::chrono::duration<double> step_time = std::chrono::steady_clock::now() - start;
+
+    start              = std::chrono::steady_clock::now();
+    const auto per_run = count_tail_locations_runs(commands, 10);
+
+    const std::chrono::duration<double> run_time = std::chrono::steady_clock::now() - start;
+
+    EXPECT_EQ(per_run, per_step);
+    std::cout << per_step << " locations: per step " << step_time.count() << "s, per run " << run_time.count() << "s" << std::endl;
+}
+
+// Not run by default; use --gtest_also_run_disabled_tests
+TEST(Day9, DISABLED_BenchmarkRopeBatch)
+{
+    std::vector<std::vector<Command>> ropes;
+    for (unsigned seed = 0; seed < 64; ++seed)
+    {
+        ropes.push_back(random_commands(20000, 10, seed));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<size_t> expected;
+    for (const auto& commands : ropes)
+    {
+        expected.push_back(count_tail_locations(commands, 10));
+    }
+    const std::chrono::duration<double> rope_time = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < ropes.size(); ++i)
+    {
+        EXPECT_EQ(count_tail_locations_fixed<10>(ropes[i]), expected[i]);
+    }
+    const std::chrono::duration<double> fixed_time = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    EXPECT_EQ(count_tail_locations_batch<10>(ropes, false), expected);
+    const std::chrono::duration<double> scalar_time = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    EXPECT_EQ(count_tail_locations_batch<10>(ropes), expected);
+    const std::chrono::duration<double> batch_time = std::chrono::steady_clock::now() - start;
+
+    std::cout << ropes.size() << " ropes: Rope " << rope_time.count() << "s, FixedRope " << fixed_time.count() << "s, batch "
+              << scalar_time.count() << "s, vectorized batch " << batch_time.count() << "s" << std::endl;
+}
 }
 
 void day_9(std::istream& in, std::ostream& out)
@@ -115,7 +1037,7 @@ void day_9(std::istream& in, std::ostream& out)
 
     const auto commands = read_input(in);
 
-    out << count_tail_locations(commands, 2);
+    out << count_tail_locations_runs(commands, 2);
 }
 
 void day_9_adv(std::istream& in, std::ostream& out)
@@ -124,7 +1046,7 @@ void day_9_adv(std::istream& in, std::ostream& out)
 
     const auto commands = read_input(in);
 
-    out << count_tail_locations(commands, 10);
+    out << count_tail_locations_runs(commands, 10);
 }
 
 TEST(Day9, Example)
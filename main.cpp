@@ -1,3 +1,4 @@
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <memory>
@@ -33,6 +34,22 @@ int main(int argc, char** argv)
             ++i;
             fout = std::make_unique<std::ofstream>(argv[i]);
             out = fout.get();
+        } else if (argi == "-c")
+        {
+            ++i;
+#ifdef _WIN32
+            _putenv_s("ADVENT_CACHE", argv[i]);
+#else
+            setenv("ADVENT_CACHE", argv[i], 1);
+#endif
+        } else if (argi == "-j")
+        {
+            ++i;
+#ifdef _WIN32
+            _putenv_s("ADVENT_THREADS", argv[i]);
+#else
+            setenv("ADVENT_THREADS", argv[i], 1);
+#endif
         }
     }
 